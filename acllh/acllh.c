@@ -0,0 +1,1159 @@
+/*
+ *      A C-Like Language Lexical Highlighter - driver
+ *
+ *      Collects the input files (walking directories), runs one scanner
+ *      per worker and writes the results in command line order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "acllh.h"
+#include "cache.h"
+#include "checkpoint.h"
+#include "decompress.h"
+#include "pool.h"
+#include "prefetch.h"
+#include "span.h"
+
+// with -j, files this large are split into chunks lexed in parallel
+#ifndef SPLIT_MIN_SIZE
+#define SPLIT_MIN_SIZE          (8 * 1024 * 1024)
+#endif
+#ifndef SPLIT_CHUNK_SIZE
+#define SPLIT_CHUNK_SIZE        (1024 * 1024)
+#endif
+
+#define CACHE_DEFAULT_MB        256
+
+static const char *source_suffixes[] = {
+    ".c", ".h", ".cc", ".cpp", ".cxx", ".hh", ".hpp", ".hxx", ".l", ".y", NULL,
+};
+
+struct filelist {
+    char **paths;
+    off_t *sizes;               // -1 for anything but a regular file, or when compressed
+    int n;
+    int cap;
+};
+
+struct result {
+    char *text;
+    char *log;
+    size_t text_len;
+    size_t log_len;
+    long records;
+    struct xref_file *xref;     // identifier locations, NULL without --xref
+    int failed;
+    int done;
+};
+
+struct chunk {
+    const char *base;
+    size_t len;
+    size_t offset;
+    int lineno;
+};
+
+struct chunk_result {
+    char *text;
+    char *log;
+    size_t text_len;
+    size_t log_len;
+    long records;
+    int exit_state;
+    struct acllh_stats stats;
+    struct intern_table *idents;        // identifiers of this run, NULL without --top
+    struct xref_file *xref;             // identifier locations of this run, NULL without --xref
+};
+
+struct split_job {
+    struct chunk *chunks;
+    int nchunks;
+    int first;                          // index of the file's first chunk in this wave
+    int last;                           // index of the file's final chunk in this wave
+    struct acllh_ctx *ctxs;
+    struct chunk_result *results;       // ACLLH_STATES per chunk
+};
+
+struct job {
+    char **paths;
+    struct prefetch *ahead;             // NULL when the files are not read ahead
+    struct acllh_ctx *ctxs;             // one per worker
+    struct result *results;             // one per file
+    struct intern_table **idents;       // identifier totals per worker, NULL without --top
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static const struct acllh_backend *backend = &acllh_full_backend;
+static const struct out_style *style = &out_ansi;
+static struct acllh_cache *cache = NULL;
+static struct intern_table *identifiers = NULL;    // run totals with --top
+static int top_n = 0;
+static struct xref_builder *xref_index = NULL;     // built with --xref
+
+static void *makesure_malloc(size_t size) {
+    void *m = calloc(1, size ? size : 1);
+    if(!m) {
+        perror("acllh");
+        exit(1);
+    }
+    return m;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-l | -t] [-s] [-b] [-j jobs] [--stats-only] [--json] [--html] [--cache dir [--cache-size MB]] [--top N] [--xref index] [--lines A:B] [--profile] [--watch] [--serve socket] [file | directory ...]\n", prog);
+    fprintf(stderr, "       %s query index name ...\n", prog);
+    fprintf(stderr, "  -l    line-buffered output (default on terminals and pipes)\n");
+    fprintf(stderr, "  -t    throughput output (default on files)\n");
+    fprintf(stderr, "  -s    always read files as streams instead of mapping or reading them ahead\n");
+    fprintf(stderr, "  -b    write the binary token stream output.tok instead of output.txt\n");
+    fprintf(stderr, "  -j N  highlight N files in parallel (0: one per CPU)\n");
+    fprintf(stderr, "  --stats-only  only count tokens, write neither highlighting nor output.txt\n");
+    fprintf(stderr, "  --json        print the summary as JSON\n");
+    fprintf(stderr, "  --html        highlight as an HTML page instead of ANSI colors\n");
+    fprintf(stderr, "  --cache DIR   reuse the results for files whose contents were highlighted before\n");
+    fprintf(stderr, "  --cache-size MB  evict least recently used entries beyond this size (default %d)\n", CACHE_DEFAULT_MB);
+    fprintf(stderr, "  --top N       report the N most frequent identifiers\n");
+    fprintf(stderr, "  --xref FILE   write an index of where every identifier occurs, for query\n");
+    fprintf(stderr, "  --lines A:B   highlight only lines A to B of each file\n");
+    fprintf(stderr, "  --profile     report matches, bytes and sampled cycles per rule (make acllh-profile)\n");
+    fprintf(stderr, "  --watch       highlight the files, then only the lines that change when they are saved\n");
+    fprintf(stderr, "  --serve PATH  answer requests on a UNIX socket with -j warm scanners\n");
+    exit(1);
+}
+
+static void filelist_add(struct filelist *fl, const char *path, const struct stat *st) {
+    if(fl->n == fl->cap) {
+        fl->cap = fl->cap ? fl->cap * 2 : 64;
+        fl->paths = realloc(fl->paths, fl->cap * sizeof(char *));
+        fl->sizes = realloc(fl->sizes, fl->cap * sizeof(off_t));
+        if(!fl->paths || !fl->sizes) {
+            perror("acllh");
+            exit(1);
+        }
+    }
+    fl->sizes[fl->n] = (S_ISREG(st->st_mode) && !decomp_kind(path)) ? st->st_size : -1;
+    fl->paths[fl->n] = strdup(path);
+    if(!fl->paths[fl->n]) {
+        perror("acllh");
+        exit(1);
+    }
+    fl->n++;
+}
+
+/* a C-like source, also when compressed (foo.c.gz) */
+static int is_source(const char *name) {
+    const char *end = name + strlen(name), *dot = end;
+    int i;
+
+    if(decomp_kind(name)) end = dot = strrchr(name, '.');
+    while(dot > name && *--dot != '.');
+    if(*dot != '.') return 0;
+    for(i = 0; source_suffixes[i]; ++i) {
+        size_t n = strlen(source_suffixes[i]);
+
+        if((size_t)(end - dot) == n && !memcmp(dot, source_suffixes[i], n)) return 1;
+    }
+    return 0;
+}
+
+static int skip_hidden(const struct dirent *d) {
+    return d->d_name[0] != '.';
+}
+
+/*
+ * Files named on the command line are always taken; inside directories
+ * only C-like sources are. Entries are sorted so the output order does
+ * not depend on the file system.
+ */
+static void walk(struct filelist *fl, const char *path, int explicit) {
+    struct stat st;
+    struct dirent **names;
+    int i, n;
+
+    if((explicit ? stat(path, &st) : lstat(path, &st)) < 0) {
+        perror(path);
+        return;
+    }
+
+    if(S_ISLNK(st.st_mode)) {
+        // follow links to files, but never into directories
+        if(stat(path, &st) < 0 || !S_ISREG(st.st_mode)) return;
+    }
+
+    if(!S_ISDIR(st.st_mode)) {
+        if(explicit || (S_ISREG(st.st_mode) && is_source(path))) filelist_add(fl, path, &st);
+        return;
+    }
+
+    n = scandir(path, &names, skip_hidden, alphasort);
+    if(n < 0) {
+        perror(path);
+        return;
+    }
+
+    for(i = 0; i < n; ++i) {
+        size_t len = strlen(path) + strlen(names[i]->d_name) + 2;
+        char *child = makesure_malloc(len);
+
+        snprintf(child, len, "%s%s%s", path,
+                 path[strlen(path) - 1] == '/' ? "" : "/", names[i]->d_name);
+        walk(fl, child, 0);
+        free(child);
+        free(names[i]);
+    }
+    free(names);
+}
+
+void acllh_stats_merge(struct acllh_stats *to, const struct acllh_stats *from) {
+    to->delimiter_num += from->delimiter_num;
+    to->reserved_word_num += from->reserved_word_num;
+    to->operator_num += from->operator_num;
+    to->constant_num += from->constant_num;
+    to->identifier_num += from->identifier_num;
+    to->macro_num += from->macro_num;
+    to->comment_num += from->comment_num;
+    to->extra_num += from->extra_num;
+    to->invalid_symbol_num += from->invalid_symbol_num;
+    to->mmap_file_num += from->mmap_file_num;
+    to->stream_file_num += from->stream_file_num;
+    to->prefetched_file_num += from->prefetched_file_num;
+    to->cache_hit_num += from->cache_hit_num;
+    to->cache_miss_num += from->cache_miss_num;
+    to->compressed_file_num += from->compressed_file_num;
+    to->compressed_bytes += from->compressed_bytes;
+    to->decompressed_bytes += from->decompressed_bytes;
+    to->decompress_ns += from->decompress_ns;
+    to->lex_ns += from->lex_ns;
+#ifdef ACLLH_PROFILE
+    {
+        int i;
+
+        for(i = 0; i < ACLLH_PROFILE_RULES; ++i) {
+            to->rules[i].matches += from->rules[i].matches;
+            to->rules[i].bytes += from->rules[i].bytes;
+            to->rules[i].samples += from->rules[i].samples;
+            to->rules[i].cycles += from->rules[i].cycles;
+        }
+    }
+#endif
+}
+
+/* move the identifiers of the file just scanned into a run table */
+static void fold_identifiers(struct acllh_ctx *ctx, struct intern_table *total) {
+    if(!ctx->idents) return;
+    intern_fold_file(total, ctx->idents);
+    intern_clear(ctx->idents);
+}
+
+/* scan file i of paths, from its read-ahead buffer when it has one */
+static int scan_listed(struct acllh_ctx *ctx, char **paths, int i, struct prefetch *ahead) {
+    size_t size;
+    char *base = ahead ? prefetch_get(ahead, i, &size) : NULL;
+    int ret = base ? backend->scan_buffer(ctx, paths[i], base, size) : backend->scan_file(ctx, paths[i]);
+
+    if(ahead) prefetch_release(ahead, i);
+    return ret;
+}
+
+/*
+ * Scan one file into r. With a cache, a file whose contents were seen
+ * before is answered from it, and a scanned one is stored for next time;
+ * the entry carries the file's own counters and identifiers so the totals
+ * come out the same either way.
+ */
+static void render_file(struct acllh_ctx *ctx, char **paths, int item, struct prefetch *ahead,
+                        struct result *r, struct intern_table *idents) {
+    const char *path = paths[item];
+    struct acllh_stats before = ctx->stats;
+    struct cache_entry e;
+    uint64_t key;
+    int cacheable = cache && cache_key(cache, path, &key) == 0;
+
+    // the result takes the locations over once the file is done
+    r->xref = NULL;
+    if(xref_index) r->xref = ctx->xref = xref_file_create();
+
+    if(cacheable && cache_load(cache, key, &e) == 0) {
+        r->failed = 0;
+        r->records = e.records;
+        r->text = e.text;
+        r->text_len = e.text_len;
+        r->log = e.log;
+        r->log_len = e.log_len;
+        if(ctx->idents) intern_unpack(ctx->idents, e.idents, e.idents_len);
+        if(ctx->xref) xref_file_unpack(ctx->xref, e.xref, e.xref_len);
+        free(e.idents);
+        free(e.xref);
+        acllh_stats_merge(&ctx->stats, &e.stats);
+        ctx->stats.cache_hit_num++;
+    } else {
+        memset(&ctx->stats, 0, sizeof(ctx->stats));
+        ctx->records = 0;
+        r->failed = scan_listed(ctx, paths, item, ahead) < 0;
+        r->records = ctx->records;
+        r->text = out_take(&ctx->text, &r->text_len);
+        r->log = out_take(&ctx->log, &r->log_len);
+
+        if(cacheable && !r->failed) {
+            e.text = r->text ? r->text : "";
+            e.text_len = r->text_len;
+            e.log = r->log ? r->log : "";
+            e.log_len = r->log_len;
+            e.idents = ctx->idents ? intern_pack(ctx->idents, &e.idents_len) : NULL;
+            e.xref = ctx->xref ? xref_file_pack(ctx->xref, &e.xref_len) : NULL;
+            e.records = r->records;
+            e.stats = ctx->stats;
+            cache_store(cache, key, &e);
+            free(e.idents);
+            free(e.xref);
+            ctx->stats.cache_miss_num++;
+        }
+        acllh_stats_merge(&ctx->stats, &before);
+    }
+
+    if(idents) fold_identifiers(ctx, idents);
+    ctx->xref = NULL;
+}
+
+static void render_one(void *arg, int worker, int item) {
+    struct job *job = arg;
+    struct result *r = &job->results[item];
+
+    render_file(&job->ctxs[worker], job->paths, item, job->ahead, r, job->idents ? job->idents[worker] : NULL);
+
+    pthread_mutex_lock(&job->lock);
+    r->done = 1;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+}
+
+/*
+ * Workers render whole files into memory; this thread writes them out
+ * strictly in list order as soon as each one is finished.
+ */
+static void run_parallel(char **paths, const off_t *sizes, int n, int jobs, int use_mmap, int logfd,
+                         struct tok_writer *tw, struct acllh_stats *total) {
+    struct job job;
+    struct pool *pool;
+    int i;
+
+    if(jobs > n) jobs = n;
+
+    job.paths = paths;
+    // a cache hit needs no read at all
+    job.ahead = (use_mmap && !cache) ? prefetch_start(paths, sizes, n) : NULL;
+    job.ctxs = makesure_malloc(jobs * sizeof(struct acllh_ctx));
+    job.results = makesure_malloc(n * sizeof(struct result));
+    job.idents = identifiers ? makesure_malloc(jobs * sizeof(struct intern_table *)) : NULL;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+
+    for(i = 0; i < jobs; ++i) {
+        if(backend->ctx_init(&job.ctxs[i]) < 0) {
+            perror("acllh");
+            exit(1);
+        }
+        job.ctxs[i].use_mmap = use_mmap;
+        job.ctxs[i].binary = (tw != NULL);
+        out_init_mem(&job.ctxs[i].text);
+        job.ctxs[i].text.style = style;
+        out_init_mem(&job.ctxs[i].log);
+        if(job.idents) {
+            job.ctxs[i].idents = intern_create();
+            job.idents[i] = intern_create();
+        }
+    }
+
+    pool = pool_start(jobs, n, render_one, &job);
+
+    for(i = 0; i < n; ++i) {
+        struct result *r = &job.results[i];
+
+        pthread_mutex_lock(&job.lock);
+        while(!r->done) pthread_cond_wait(&job.cond, &job.lock);
+        pthread_mutex_unlock(&job.lock);
+
+        out_write(STDOUT_FILENO, r->text, r->text_len);
+        out_write(logfd, r->log, r->log_len);
+        // a compressed file can fail after it was scanned; its records are in the log all the same
+        if(tw && (!r->failed || r->records)) tok_writer_file(tw, paths[i], r->records);
+        if(r->xref && !r->failed) xref_builder_add(xref_index, xref_builder_file(xref_index, paths[i]), r->xref);
+        xref_file_destroy(r->xref);
+        free(r->text);
+        free(r->log);
+    }
+
+    pool_join(pool);
+    if(job.ahead) prefetch_stop(job.ahead);
+
+    // every worker's table is merged once, here
+    for(i = 0; i < jobs; ++i) {
+        acllh_stats_merge(total, &job.ctxs[i].stats);
+        if(job.idents) {
+            intern_merge(identifiers, job.idents[i]);
+            intern_destroy(job.idents[i]);
+            intern_destroy(job.ctxs[i].idents);
+        }
+        backend->ctx_destroy(&job.ctxs[i]);
+    }
+
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.lock);
+    free(job.idents);
+    free(job.results);
+    free(job.ctxs);
+}
+
+static void write_str(int fd, const char *s) {
+    out_write(fd, s, strlen(s));
+}
+
+/* file header or trailer in the text style, for a file assembled from chunks */
+static void write_file_mark(const char *path) {
+    struct outbuf *o = makesure_malloc(sizeof(struct outbuf));
+    size_t len;
+    char *mem;
+
+    out_init_mem(o);
+    o->style = style;
+    if(path) out_file_begin(o, path);
+    else out_file_end(o);
+    mem = out_take(o, &len);
+    out_write(STDOUT_FILENO, mem, len);
+    free(mem);
+    free(o);
+}
+
+static void render_chunk(void *arg, int worker, int item) {
+    struct split_job *job = arg;
+    struct acllh_ctx *ctx = &job->ctxs[worker];
+    struct chunk_result *r = &job->results[item];
+    int c = item / ACLLH_STATES, state = item % ACLLH_STATES;
+    int flags = (c == job->last ? ACLLH_CHUNK_LAST : 0) | (c == job->first ? ACLLH_CHUNK_FIRST : 0);
+
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    ctx->records = 0;
+    ctx->idents = r->idents;
+    ctx->xref = r->xref;
+    r->exit_state = backend->scan_chunk(ctx, job->chunks[c].base, job->chunks[c].len,
+                                        job->chunks[c].offset, job->chunks[c].lineno, state, flags);
+    r->records = ctx->records;
+    r->text = out_take(&ctx->text, &r->text_len);
+    r->log = out_take(&ctx->log, &r->log_len);
+    r->stats = ctx->stats;
+}
+
+/*
+ * Split one large file at newlines and lex the pieces in parallel.
+ * A piece may begin inside a comment or string opened by an earlier
+ * one, so each piece is lexed once from every start condition it could
+ * be in. Walking the pieces in order then picks the run that matches
+ * the previous piece's exit state. Pieces go in waves of one per
+ * worker so only that many results are held at once.
+ */
+static void run_split(const char *path, off_t size, int jobs, int logfd,
+                      struct tok_writer *tw, struct acllh_stats *total) {
+    struct split_job job;
+    struct pool *pool;
+    struct intern_table *file_idents = NULL;
+    const char *base, *p, *end;
+    int fd, i, c, first, nchunks, state = ACLLH_INITIAL, lineno = 1;
+    uint32_t xref_file = 0;
+    long records = 0;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        perror(path);
+        return;
+    }
+    base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        perror(path);
+        return;
+    }
+    end = base + size;
+
+    // cut at the first newline after every SPLIT_CHUNK_SIZE bytes
+    nchunks = (size + SPLIT_CHUNK_SIZE - 1) / SPLIT_CHUNK_SIZE;
+    job.chunks = makesure_malloc(nchunks * sizeof(struct chunk));
+    for(p = base, c = 0; p < end; ++c) {
+        const char *cut = (end - p > SPLIT_CHUNK_SIZE) ? memchr(p + SPLIT_CHUNK_SIZE, '\n',
+                                                               end - p - SPLIT_CHUNK_SIZE) : NULL;
+        const char *next = cut ? cut + 1 : end;
+        const char *q;
+
+        job.chunks[c].base = p;
+        job.chunks[c].len = next - p;
+        job.chunks[c].offset = p - base;
+        job.chunks[c].lineno = lineno;
+        for(q = p; (q = memchr(q, '\n', next - q)); ++q) lineno++;
+        p = next;
+    }
+    nchunks = c;
+
+    job.ctxs = makesure_malloc(jobs * sizeof(struct acllh_ctx));
+    job.results = makesure_malloc(jobs * ACLLH_STATES * sizeof(struct chunk_result));
+    if(identifiers) {
+        file_idents = intern_create();
+        for(i = 0; i < jobs * ACLLH_STATES; ++i) job.results[i].idents = intern_create();
+    }
+    if(xref_index) {
+        xref_file = xref_builder_file(xref_index, path);
+        for(i = 0; i < jobs * ACLLH_STATES; ++i) job.results[i].xref = xref_file_create();
+    }
+    for(i = 0; i < jobs; ++i) {
+        if(backend->ctx_init(&job.ctxs[i]) < 0) {
+            perror("acllh");
+            exit(1);
+        }
+        out_init_mem(&job.ctxs[i].text);
+        job.ctxs[i].text.style = style;
+        job.ctxs[i].binary = (tw != NULL);
+        out_init_mem(&job.ctxs[i].log);
+    }
+
+    if(backend->output) {
+        if(!tw) {
+            write_str(logfd, "------     ");
+            write_str(logfd, path);
+            write_str(logfd, "     ------\n\n");
+        }
+        write_file_mark(path);
+    }
+
+    for(first = 0; first < nchunks; first += jobs) {
+        int n = (nchunks - first < jobs) ? nchunks - first : jobs;
+        struct chunk *saved = job.chunks;
+
+        job.chunks = saved + first;
+        job.first = -first;
+        job.last = nchunks - 1 - first;
+        pool = pool_start(jobs, n * ACLLH_STATES, render_chunk, &job);
+        pool_join(pool);
+        job.chunks = saved;
+
+        // fix-up: follow the exit states through the wave
+        for(c = 0; c < n; ++c) {
+            struct chunk_result *r = &job.results[c * ACLLH_STATES + state];
+
+            out_write(STDOUT_FILENO, r->text, r->text_len);
+            out_write(logfd, r->log, r->log_len);
+            acllh_stats_merge(total, &r->stats);
+            records += r->records;
+            if(file_idents) intern_merge(file_idents, r->idents);
+            if(xref_index) xref_builder_add(xref_index, xref_file, r->xref);
+            state = r->exit_state;
+
+            for(i = 0; i < ACLLH_STATES; ++i) {
+                free(job.results[c * ACLLH_STATES + i].text);
+                free(job.results[c * ACLLH_STATES + i].log);
+                if(file_idents) intern_clear(job.results[c * ACLLH_STATES + i].idents);
+                if(xref_index) xref_file_clear(job.results[c * ACLLH_STATES + i].xref);
+            }
+        }
+    }
+
+    if(tw) tok_writer_file(tw, path, records);
+    if(backend->output) {
+        if(!tw) write_str(logfd, "\n\n");
+        write_file_mark(NULL);
+    }
+    total->mmap_file_num++;
+    if(file_idents) {
+        intern_fold_file(identifiers, file_idents);
+        intern_destroy(file_idents);
+        for(i = 0; i < jobs * ACLLH_STATES; ++i) intern_destroy(job.results[i].idents);
+    }
+    for(i = 0; i < jobs * ACLLH_STATES; ++i) xref_file_destroy(job.results[i].xref);
+
+    for(i = 0; i < jobs; ++i) backend->ctx_destroy(&job.ctxs[i]);
+    free(job.results);
+    free(job.ctxs);
+    free(job.chunks);
+    munmap((void *)base, size);
+}
+
+/* checkpoints for the file, from the cache if they were built before */
+static void get_checkpoints(struct checkpoints *cp, const char *path, const char *base, size_t size,
+                            struct acllh_stats *total) {
+    uint64_t key;
+    size_t len;
+    char *blob;
+
+    // without a cache a full pass would not pay off; seek from line 1
+    if(!cache || cache_key(cache, path, &key) < 0) {
+        checkpoints_origin(cp, size);
+        return;
+    }
+
+    blob = cache_load_side(cache, key, "lines", &len);
+    if(blob && checkpoints_unpack(cp, blob, len, size) == 0) {
+        total->cache_hit_num++;
+        free(blob);
+        return;
+    }
+    free(blob);
+
+    checkpoints_build(cp, base, size);
+    blob = checkpoints_pack(cp, &len);
+    cache_store_side(cache, key, "lines", blob, len);
+    free(blob);
+    total->cache_miss_num++;
+}
+
+/*
+ * --lines A:B: highlight only lines first..last of a file. Lexing starts
+ * at the line's checkpointed state, so nothing before it is rendered.
+ */
+static void run_lines(const char *path, int first, int last, int logfd,
+                      struct tok_writer *tw, struct acllh_stats *total) {
+    struct acllh_ctx *ctx;
+    struct checkpoints cp;
+    struct stat st;
+    const char *base = NULL, *from, *to, *end;
+    size_t offset, len = 0;
+    int fd, line, state;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if(fd >= 0) close(fd);
+        return;
+    }
+    if(!S_ISREG(st.st_mode) || decomp_kind(path)) {
+        fprintf(stderr, "%s: --lines needs a regular, uncompressed file\n", path);
+        close(fd);
+        return;
+    }
+    if(st.st_size) base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        perror(path);
+        return;
+    }
+    end = base + st.st_size;
+
+    get_checkpoints(&cp, path, base, st.st_size, total);
+    state = checkpoints_seek(&cp, base, first, &offset);
+    checkpoints_free(&cp);
+
+    from = to = base + offset;
+    for(line = first; line <= last && to < end; ++line) {
+        const char *nl = memchr(to, '\n', end - to);
+
+        to = nl ? nl + 1 : end;
+    }
+    // a newline at the end would number one more line; it is written plainly below
+    len = to - from;
+    if(len && from[len - 1] == '\n') len--;
+
+    ctx = makesure_malloc(sizeof(struct acllh_ctx));
+    if(backend->ctx_init(ctx) < 0) {
+        perror("acllh");
+        exit(1);
+    }
+    out_init_mem(&ctx->text);
+    ctx->text.style = style;
+    ctx->binary = (tw != NULL);
+    out_init_mem(&ctx->log);
+
+    if(backend->output) {
+        if(!tw) {
+            write_str(logfd, "------     ");
+            write_str(logfd, path);
+            write_str(logfd, "     ------\n\n");
+        }
+        write_file_mark(path);
+    }
+
+    if(from < end) {
+        char *text, *log;
+        size_t text_len, log_len;
+
+        backend->scan_chunk(ctx, from, len, offset, first, state,
+                            ACLLH_CHUNK_FIRST | ACLLH_CHUNK_LAST);
+        text = out_take(&ctx->text, &text_len);
+        log = out_take(&ctx->log, &log_len);
+        out_write(STDOUT_FILENO, text, text_len);
+        if(backend->output) write_str(STDOUT_FILENO, "\n");
+        out_write(logfd, log, log_len);
+        free(text);
+        free(log);
+    }
+
+    if(tw) tok_writer_file(tw, path, ctx->records);
+    if(backend->output) {
+        if(!tw) write_str(logfd, "\n\n");
+        write_file_mark(NULL);
+    }
+    ctx->stats.mmap_file_num++;
+    acllh_stats_merge(total, &ctx->stats);
+
+    backend->ctx_destroy(ctx);
+    free(ctx);
+    if(base) munmap((void *)base, st.st_size);
+}
+
+static void run_sequential(struct filelist *fl, int use_stdin, int use_mmap, enum out_mode mode,
+                           int logfd, struct tok_writer *tw, struct acllh_stats *total) {
+    struct acllh_ctx *ctx = makesure_malloc(sizeof(struct acllh_ctx));
+    struct prefetch *ahead = (use_mmap && fl->n) ? prefetch_start(fl->paths, fl->sizes, fl->n) : NULL;
+    int i;
+
+    if(backend->ctx_init(ctx) < 0) {
+        perror("acllh");
+        exit(1);
+    }
+    ctx->use_mmap = use_mmap;
+    ctx->binary = (tw != NULL);
+    out_init(&ctx->text, STDOUT_FILENO, mode);
+    ctx->text.style = style;
+    out_init(&ctx->log, logfd, OUT_MODE_THROUGHPUT);
+    if(identifiers) ctx->idents = intern_create();
+    if(xref_index) ctx->xref = xref_file_create();
+
+    if(use_stdin) {
+        backend->scan_stream(ctx, stdin);
+        if(tw) tok_writer_file(tw, "-", ctx->records);
+        if(identifiers) fold_identifiers(ctx, identifiers);
+        if(xref_index) {
+            xref_builder_add(xref_index, xref_builder_file(xref_index, "-"), ctx->xref);
+            xref_file_clear(ctx->xref);
+        }
+    }
+    for(i = 0; i < fl->n; ++i) {
+        long before = ctx->records;
+        int failed = scan_listed(ctx, fl->paths, i, ahead) < 0;
+        long records = ctx->records - before;
+
+        // a compressed file can fail after it was scanned; its records are in the log all the same
+        if(tw && (!failed || records)) tok_writer_file(tw, fl->paths[i], records);
+        if(identifiers) fold_identifiers(ctx, identifiers);
+        if(xref_index) {
+            if(!failed) xref_builder_add(xref_index, xref_builder_file(xref_index, fl->paths[i]), ctx->xref);
+            xref_file_clear(ctx->xref);
+        }
+    }
+
+    out_flush(&ctx->log);
+    out_flush(&ctx->text);
+    if(ahead) prefetch_stop(ahead);
+
+    acllh_stats_merge(total, &ctx->stats);
+    intern_destroy(ctx->idents);
+    xref_file_destroy(ctx->xref);
+    backend->ctx_destroy(ctx);
+    free(ctx);
+}
+
+/* decompressed megabytes per second of CPU time */
+static double mb_per_s(long bytes, long ns) {
+    return ns ? bytes / 1e6 / (ns / 1e9) : 0;
+}
+
+static void print_summary(const struct acllh_stats *s) {
+	printf( "\n\n-----   Summary  -----\n");
+	printf(DYES("macros:             %ld\n", MACRO_COLOR),           s->macro_num);
+	printf(DYES("reserved words:     %ld\n", RESERVED_WORD_COLOR),   s->reserved_word_num);
+	printf(DYES("operators:          %ld\n", OPERATOR_COLOR),        s->operator_num);
+	printf(DYES("constants:          %ld\n", CONSTANT_COLOR),        s->constant_num);
+	printf(DYES("identifiers:        %ld\n", IDENTIFIER_COLOR),      s->identifier_num);
+	printf(DYES("comments:           %ld\n", COMMENT_COLOR),         s->comment_num);
+    printf(     "delimiters:         %ld\n",                         s->delimiter_num);
+    printf(     "extra symbols:      %ld\n",                         s->extra_num);
+    printf(DYES("invalid symbols:    %ld\n", INVALID_SYMBOL_COLOR),  s->invalid_symbol_num);
+    printf(     "input:              %ld mmap, %ld stream, %ld read ahead\n", s->mmap_file_num, s->stream_file_num,
+                s->prefetched_file_num);
+    if(cache) {
+        printf( "cache:              %ld hits, %ld misses\n",        s->cache_hit_num, s->cache_miss_num);
+    }
+    if(s->compressed_file_num) {
+        printf( "compressed:         %ld files, %ld bytes to %ld\n", s->compressed_file_num,
+                s->compressed_bytes, s->decompressed_bytes);
+        printf( "throughput:         decompress %.1f MB/s, lex %.1f MB/s\n",
+                mb_per_s(s->decompressed_bytes, s->decompress_ns), mb_per_s(s->decompressed_bytes, s->lex_ns));
+    }
+}
+
+static void print_summary_html(const struct acllh_stats *s) {
+    printf("<pre class=\"summary\">\n-----   Summary  -----\n");
+    printf("<span class=\"macro\">macros:             %ld</span>\n",          s->macro_num);
+    printf("<span class=\"reserved\">reserved words:     %ld</span>\n",       s->reserved_word_num);
+    printf("<span class=\"operator\">operators:          %ld</span>\n",       s->operator_num);
+    printf("<span class=\"constant\">constants:          %ld</span>\n",       s->constant_num);
+    printf("<span class=\"identifier\">identifiers:        %ld</span>\n",     s->identifier_num);
+    printf("<span class=\"comment\">comments:           %ld</span>\n",        s->comment_num);
+    printf("delimiters:         %ld\n",                                        s->delimiter_num);
+    printf("extra symbols:      %ld\n",                                        s->extra_num);
+    printf("<span class=\"invalid\">invalid symbols:    %ld</span>\n",        s->invalid_symbol_num);
+    printf("input:              %ld mmap, %ld stream, %ld read ahead\n",       s->mmap_file_num, s->stream_file_num,
+           s->prefetched_file_num);
+    if(cache) {
+        printf("cache:              %ld hits, %ld misses\n",                   s->cache_hit_num, s->cache_miss_num);
+    }
+    if(s->compressed_file_num) {
+        printf("compressed:         %ld files, %ld bytes to %ld\n",            s->compressed_file_num,
+               s->compressed_bytes, s->decompressed_bytes);
+        printf("throughput:         decompress %.1f MB/s, lex %.1f MB/s\n",
+               mb_per_s(s->decompressed_bytes, s->decompress_ns), mb_per_s(s->decompressed_bytes, s->lex_ns));
+    }
+    printf("</pre>\n");
+}
+
+int acllh_stats_json(char *buf, size_t size, const struct acllh_stats *s) {
+    int n = snprintf(buf, size,
+           "{\"macros\": %ld, \"reserved_words\": %ld, \"operators\": %ld, "
+           "\"constants\": %ld, \"identifiers\": %ld, \"comments\": %ld, "
+           "\"delimiters\": %ld, \"extra_symbols\": %ld, \"invalid_symbols\": %ld, "
+           "\"input\": {\"mmap\": %ld, \"stream\": %ld, \"read_ahead\": %ld}, "
+           "\"cache\": {\"hits\": %ld, \"misses\": %ld}, "
+           "\"compressed\": {\"files\": %ld, \"bytes\": %ld, \"decompressed_bytes\": %ld, "
+           "\"decompress_mb_s\": %.1f, \"lex_mb_s\": %.1f}}",
+           s->macro_num, s->reserved_word_num, s->operator_num,
+           s->constant_num, s->identifier_num, s->comment_num,
+           s->delimiter_num, s->extra_num, s->invalid_symbol_num,
+           s->mmap_file_num, s->stream_file_num, s->prefetched_file_num,
+           s->cache_hit_num, s->cache_miss_num,
+           s->compressed_file_num, s->compressed_bytes, s->decompressed_bytes,
+           mb_per_s(s->decompressed_bytes, s->decompress_ns), mb_per_s(s->decompressed_bytes, s->lex_ns));
+
+    return (n < 0 || (size_t)n >= size) ? (int)size - 1 : n;
+}
+
+static void print_summary_json(const struct acllh_stats *s) {
+    const struct intern_entry **top;
+    char buf[1024];
+    int n = acllh_stats_json(buf, sizeof(buf), s);
+    size_t i, k;
+
+    if(!identifiers) {
+        printf("%s\n", buf);
+        return;
+    }
+
+    // the identifiers go inside the summary object
+    top = makesure_malloc(top_n * sizeof(struct intern_entry *));
+    k = intern_top(identifiers, top, top_n);
+    printf("%.*s, \"top_identifiers\": [", n - 1, buf);
+    for(i = 0; i < k; ++i) {
+        printf("%s{\"name\": \"%.*s\", \"count\": %ld, \"files\": %ld, \"peak\": %ld}",
+               i ? ", " : "", (int)top[i]->len, top[i]->name, top[i]->count, top[i]->files, top[i]->peak);
+    }
+    printf("]}\n");
+    free(top);
+}
+
+#ifdef ACLLH_PROFILE
+static double rule_cycles(const struct acllh_rule_profile *r) {
+    return r->samples ? (double)r->cycles / r->samples * r->matches : 0;
+}
+
+static int cmp_rule_cycles(const void *a, const void *b) {
+    double x = rule_cycles(*(const struct acllh_rule_profile **)a);
+    double y = rule_cycles(*(const struct acllh_rule_profile **)b);
+
+    return (x < y) - (x > y);
+}
+
+/*
+ * Matches, bytes and the estimated share of action time per rule, most
+ * expensive first, then the rates of the whole run. The time of a rule
+ * is its mean over the sampled matches times its matches.
+ */
+static void print_profile(const struct acllh_stats *s, double seconds) {
+    const struct acllh_rule_profile *order[ACLLH_PROFILE_RULES];
+    int html = (style == &out_html);
+    long tokens, bytes = 0;
+    double cycles = 0;
+    int i, n = 0;
+
+    for(i = 1; i < ACLLH_PROFILE_RULES; ++i) {
+        if(!s->rules[i].matches) continue;
+        order[n++] = &s->rules[i];
+        bytes += s->rules[i].bytes;
+        cycles += rule_cycles(&s->rules[i]);
+    }
+    qsort(order, n, sizeof(order[0]), cmp_rule_cycles);
+    tokens = s->macro_num + s->reserved_word_num + s->operator_num + s->constant_num
+             + s->identifier_num + s->comment_num + s->delimiter_num + s->extra_num
+             + s->invalid_symbol_num;
+
+    printf(html ? "<pre class=\"summary\">\n" : "\n");
+    printf("-----   Profile  -----\n");
+    printf("%-28s %12s %12s %10s %7s\n", "rule", "matches", "bytes", "cycles", "time");
+    for(i = 0; i < n; ++i) {
+        const struct acllh_rule_profile *r = order[i];
+        const char *name = acllh_rule_names[r - s->rules];
+
+        printf("%-28s %12ld %12ld ", name ? name : "?", r->matches, r->bytes);
+        if(r->samples) printf("%10.1f %6.1f%%\n", (double)r->cycles / r->samples,
+                            cycles ? rule_cycles(r) * 100 / cycles : 0.0);
+        else printf("%10s %7s\n", "-", "-");
+    }
+    if(seconds > 0) {
+        printf("tokens:             %ld, %.1f M/s\n", tokens, tokens / seconds / 1e6);
+        printf("bytes:              %ld, %.1f MB/s in %.3f s\n", bytes, bytes / seconds / 1e6, seconds);
+    }
+    if(html) printf("</pre>\n");
+}
+#else
+static void print_profile(const struct acllh_stats *s, double seconds) {
+    (void)s;
+    (void)seconds;
+}
+#endif
+
+/* the top_n most frequent identifiers, with the files they occur in and the most in one file */
+static void print_identifiers(void) {
+    const struct intern_entry **top = makesure_malloc(top_n * sizeof(struct intern_entry *));
+    int html = (style == &out_html);
+    size_t i, k = intern_top(identifiers, top, top_n);
+
+    printf(html ? "<pre class=\"summary\">\n" : "\n");
+    printf("-----   Top %d identifiers  -----\n", top_n);
+    printf("%10s %8s %8s  %s\n", "count", "files", "peak", "identifier");
+    for(i = 0; i < k; ++i) {
+        printf("%10ld %8ld %8ld  %s%.*s%s\n", top[i]->count, top[i]->files, top[i]->peak,
+               html ? "<span class=\"identifier\">" : IDENTIFIER_COLOR,
+               (int)top[i]->len, top[i]->name, html ? "</span>" : NONE);
+    }
+    if(html) printf("</pre>\n");
+    free(top);
+}
+
+/*
+ * acllh query INDEX NAME...: print every location of each name as
+ * path:line:column, and on stderr how long looking it up took.
+ */
+static int query(int argc, char **argv) {
+    struct xref_index x;
+    int i, status = 0;
+
+    if(argc < 3) {
+        fprintf(stderr, "usage: acllh query index name ...\n");
+        return 1;
+    }
+    if(xref_open(&x, argv[1]) < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    for(i = 2; i < argc; ++i) {
+        const struct xref_name *n;
+        struct xref_cursor c;
+        struct xref_loc loc;
+        struct timespec start, end;
+        long found = 0;
+        int ret = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        n = xref_find(&x, argv[i], strlen(argv[i]));
+        if(n) {
+            xref_cursor_init(&x, n, &c);
+            while((ret = xref_next(&c, &loc)) > 0 && loc.file < x.header->nfiles) {
+                printf("%s:%u:%u\n", xref_path(&x, loc.file), loc.line, loc.col);
+                found++;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if(ret != 0) fprintf(stderr, "%s: damaged index\n", argv[1]);
+        if(!found || ret != 0) status = 1;
+        fprintf(stderr, "%s: %ld locations in %.1f us\n", argv[i], found,
+                (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3);
+    }
+
+    xref_close(&x);
+    return status;
+}
+
+enum { OPT_STATS_ONLY = 256, OPT_JSON, OPT_HTML, OPT_CACHE, OPT_CACHE_SIZE, OPT_TOP, OPT_XREF, OPT_LINES, OPT_PROFILE, OPT_WATCH, OPT_SERVE };
+
+static const struct option long_options[] = {
+    { "stats-only", no_argument, NULL, OPT_STATS_ONLY },
+    { "json",       no_argument, NULL, OPT_JSON },
+    { "html",       no_argument, NULL, OPT_HTML },
+    { "cache",      required_argument, NULL, OPT_CACHE },
+    { "cache-size", required_argument, NULL, OPT_CACHE_SIZE },
+    { "top",        required_argument, NULL, OPT_TOP },
+    { "xref",       required_argument, NULL, OPT_XREF },
+    { "lines",      required_argument, NULL, OPT_LINES },
+    { "profile",    no_argument,       NULL, OPT_PROFILE },
+    { "watch",      no_argument,       NULL, OPT_WATCH },
+    { "serve",      required_argument, NULL, OPT_SERVE },
+    { NULL, 0, NULL, 0 },
+};
+
+int main(int argc, char **argv) {
+    int i, opt, logfd;
+    int use_mmap = 1, jobs = 1, binary = 0, json = 0, first_line = 0, last_line = 0, watch = 0;
+    int profile = 0;
+    const char *logname, *socket_path = NULL, *cache_dir = NULL, *index_path = NULL;
+    long cache_mb = CACHE_DEFAULT_MB;
+    struct acllh_cache disk_cache;
+    struct tok_writer tw;
+    enum out_mode mode = OUT_MODE_AUTO;
+    struct filelist files = { NULL, NULL, 0, 0 };
+    struct acllh_stats total;
+    struct timespec started, finished;
+
+    span = span_best();
+
+    if(argc > 1 && !strcmp(argv[1], "query")) return query(argc - 1, argv + 1);
+
+    while((opt = getopt_long(argc, argv, "ltsbj:", long_options, NULL)) != -1) {
+        switch(opt) {
+            case 'l': mode = OUT_MODE_LINE; break;
+            case 't': mode = OUT_MODE_THROUGHPUT; break;
+            case 's': use_mmap = 0; break;
+            case 'b': binary = 1; break;
+            case OPT_STATS_ONLY: backend = &acllh_stats_backend; break;
+            case OPT_JSON: json = 1; break;
+            case OPT_HTML: style = &out_html; break;
+            case OPT_CACHE: cache_dir = optarg; break;
+            case OPT_CACHE_SIZE:
+                cache_mb = atol(optarg);
+                if(cache_mb <= 0) usage(argv[0]);
+                break;
+            case OPT_TOP:
+                top_n = atoi(optarg);
+                if(top_n <= 0) usage(argv[0]);
+                break;
+            case OPT_XREF: index_path = optarg; break;
+            case OPT_LINES:
+                if(sscanf(optarg, "%d:%d", &first_line, &last_line) == 1) last_line = first_line;
+                if(first_line <= 0 || last_line < first_line) usage(argv[0]);
+                break;
+            case OPT_PROFILE:
+#ifndef ACLLH_PROFILE
+                fprintf(stderr, "acllh: --profile needs the instrumented build, make acllh-profile\n");
+                return 1;
+#else
+                profile = 1;
+                break;
+#endif
+            case OPT_WATCH: watch = 1; break;
+            case OPT_SERVE: socket_path = optarg; break;
+            case 'j':
+                jobs = atoi(optarg);
+                if(jobs <= 0) jobs = sysconf(_SC_NPROCESSORS_ONLN);
+                if(jobs <= 0) jobs = 1;
+                break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if(socket_path) return acllh_serve(socket_path, jobs, backend, style) < 0;
+
+    for(i = optind; i < argc; ++i) {
+        walk(&files, argv[i], 1);
+    }
+    if(watch) {
+        if(!files.n || !backend->output) {
+            fprintf(stderr, "acllh: --watch needs files and highlighting\n");
+            return 1;
+        }
+        return acllh_watch(files.paths, files.n, style) < 0;
+    }
+    if(top_n) identifiers = intern_create();
+    if(index_path) {
+        // columns come from the positions only the highlighting scanner tracks
+        if(!backend->output) {
+            fprintf(stderr, "acllh: --xref does not work with --stats-only\n");
+            return 1;
+        }
+        xref_index = xref_builder_create();
+    }
+
+    // without output there is no log either; leave an existing one alone
+    if(!backend->output) binary = 0;
+    logname = binary ? "output.tok" : "output.txt";
+    logfd = backend->output ? open(logname, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    if((backend->output && logfd < 0) || (binary && tok_writer_open(&tw, logfd) < 0)) {
+        perror(logname);
+        return 1;
+    }
+
+    if(cache_dir) {
+        char options[128];
+
+        // everything besides the contents and the path that shapes an entry
+        snprintf(options, sizeof(options), "output %d, binary %d, mmap %d, style %s, idents %d, xref %d",
+                 backend->output, binary, use_mmap, style->name, identifiers != NULL, xref_index != NULL);
+        if(cache_open(&disk_cache, cache_dir, (size_t)cache_mb << 20, options) < 0) return 1;
+        cache = &disk_cache;
+    }
+
+    memset(&total, 0, sizeof(total));
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    if(backend->output) out_write(STDOUT_FILENO, style->doc_begin.s, style->doc_begin.n);
+    if(first_line) {
+        if(!files.n) {
+            fprintf(stderr, "acllh: --lines needs files\n");
+            return 1;
+        }
+        for(i = 0; i < files.n; ++i) {
+            run_lines(files.paths[i], first_line, last_line, logfd, binary ? &tw : NULL, &total);
+        }
+    } else if((jobs > 1 || cache) && files.n) {
+        // the cache works on whole files in memory, which is what the workers produce
+        int split = (jobs > 1 && use_mmap);
+        int j;
+
+        for(i = 0; i < files.n; i = j) {
+            if(split && files.sizes[i] >= SPLIT_MIN_SIZE) {
+                run_split(files.paths[i], files.sizes[i], jobs, logfd, binary ? &tw : NULL, &total);
+                j = i + 1;
+                continue;
+            }
+            for(j = i; j < files.n && !(split && files.sizes[j] >= SPLIT_MIN_SIZE); ++j);
+            run_parallel(files.paths + i, files.sizes + i, j - i, jobs, use_mmap, logfd, binary ? &tw : NULL, &total);
+        }
+    } else {
+        run_sequential(&files, optind >= argc, use_mmap, mode, logfd, binary ? &tw : NULL, &total);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+
+    if(binary && tok_writer_close(&tw) < 0) perror(logname);
+    if(xref_index) {
+        if(xref_builder_write(xref_index, index_path) < 0) perror(index_path);
+        xref_builder_destroy(xref_index);
+    }
+    if(logfd >= 0) close(logfd);
+    if(cache) {
+        cache_trim(cache);
+        cache_close(cache);
+    }
+
+    if(json) print_summary_json(&total);
+    else if(style == &out_html) print_summary_html(&total);
+    else print_summary(&total);
+    if(identifiers && !json) print_identifiers();
+    if(profile && !json) {
+        print_profile(&total, (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9);
+    }
+    if(backend->output) {
+        fflush(stdout);
+        out_write(STDOUT_FILENO, style->doc_end.s, style->doc_end.n);
+    }
+
+    for(i = 0; i < files.n; ++i) free(files.paths[i]);
+    free(files.paths);
+    free(files.sizes);
+    intern_destroy(identifiers);
+
+	return 0;
+}
@@ -0,0 +1,172 @@
+#ifndef __ACLLH_H
+#define __ACLLH_H
+
+/*
+ *      A C-Like Language Lexical Highlighter
+ *
+ *      Declarations shared by the scanner (acllh.l) and the driver (acllh.c).
+ */
+
+#include <stdio.h>
+#include "intern.h"
+#include "output.h"
+#include "tokstream.h"
+#include "xref.h"
+
+#define NONE                    "\e[0m"
+#define BLACK                   "\e[0;30m"
+#define L_BLACK                 "\e[1;30m"
+#define RED                     "\e[0;31m"
+#define L_RED                   "\e[1;31m"
+#define GREEN                   "\e[0;32m"
+#define L_GREEN                 "\e[1;32m"
+#define BROWN                   "\e[0;33m"
+#define YELLOW                  "\e[1;33m"
+#define BLUE                    "\e[0;34m"
+#define L_BLUE                  "\e[1;34m"
+#define PURPLE                  "\e[0;35m"
+#define L_PURPLE                "\e[1;35m"
+#define CYAN                    "\e[0;36m"
+#define L_CYAN                  "\e[1;36m"
+#define GRAY                    "\e[0;37m"
+#define WHITE                   "\e[1;37m"
+
+#define BOLD                    "\e[1m"
+#define UNDERLINE               "\e[4m"
+#define BLINK                   "\e[5m"
+#define REVERSE                 "\e[7m"
+#define HIDE                    "\e[8m"
+#define CLEAR                   "\e[2J"
+#define CLRLINE                 "\r\e[K" //or "\e[1K\r"
+
+#define MACRO_COLOR             BROWN
+#define COMMENT_COLOR           GREEN
+#define CONSTANT_COLOR          PURPLE
+#define OPERATOR_COLOR          GRAY
+#define RESERVED_WORD_COLOR     BLUE
+#define IDENTIFIER_COLOR        L_CYAN
+#define INVALID_SYMBOL_COLOR    RED
+
+#define LINE_NO_COLOR           L_RED
+
+#define DYES(string, color)     color string NONE
+
+#ifdef ACLLH_PROFILE
+#define ACLLH_PROFILE_RULES     32      // above the number of rules in acllh.l, flex's default rule included
+#define ACLLH_PROFILE_SAMPLE    64      // one action in this many is timed
+
+/* one rule of acllh.l, by the number flex gives it (yy_act) */
+struct acllh_rule_profile {
+    long matches;
+    long bytes;
+    long samples;
+    unsigned long long cycles;  // spent in the sampled actions
+};
+#endif
+
+struct acllh_stats {
+    long delimiter_num;
+    long reserved_word_num;
+    long operator_num;
+    long constant_num;
+    long identifier_num;
+    long macro_num;
+    long comment_num;
+    long extra_num;
+    long invalid_symbol_num;
+    long mmap_file_num;
+    long stream_file_num;
+    long prefetched_file_num;   // read ahead, see prefetch.h
+    long cache_hit_num;
+    long cache_miss_num;
+    long compressed_file_num;
+    long compressed_bytes;      // read from compressed files
+    long decompressed_bytes;    // lexed out of them
+    long decompress_ns;         // CPU time of the decompressor threads
+    long lex_ns;                // CPU time spent lexing what they produced
+#ifdef ACLLH_PROFILE
+    struct acllh_rule_profile rules[ACLLH_PROFILE_RULES];
+#endif
+};
+
+/* the state each line starts in, appended at every newline the scanner passes */
+struct acllh_lines {
+    unsigned char *states;      // enum acllh_state
+    size_t n;
+    size_t cap;
+};
+
+/*
+ * Everything one scanner instance touches. Each worker thread owns one,
+ * so the counters are plain integers merged once at the end.
+ */
+struct acllh_ctx {
+    void *scanner;              // yyscan_t
+    int use_mmap;
+    int text_stable;            // yytext points into a mapping that outlives the token
+    int open_ended;             // input continues in a later chunk, keep comments open at EOF
+    int binary;                 // log tok_records instead of output.txt lines
+    size_t pos;                 // byte offset of the end of yytext
+    size_t line_start;          // byte offset of the current line
+    long records;               // tok_records logged so far
+    struct tok_record pending;  // record of the token being logged
+    struct intern_table *idents;  // identifiers of the current file, NULL when not counted
+    struct xref_file *xref;     // identifier locations of the current file, NULL when not indexed
+    struct acllh_lines *lines;  // state of every line, NULL when not recorded
+    struct acllh_tokens *tokens;  // batch being filled, in the library build (libacllh.h)
+#ifdef ACLLH_PROFILE
+    unsigned long profile_tick;
+    unsigned long long profile_start;   // cycle count when a sampled action began, else 0
+#endif
+    struct outbuf text;
+    struct outbuf log;          // per-token lines for output.txt, or tok_records
+    struct acllh_stats stats;
+};
+
+/* start conditions a chunk of a split file can begin or end in */
+enum acllh_state {
+    ACLLH_INITIAL = 0,
+    ACLLH_BLOCKCOMMENT,
+    ACLLH_BLOCKSTRING,
+    ACLLH_STATES
+};
+
+#define ACLLH_CHUNK_FIRST       1
+#define ACLLH_CHUNK_LAST        2
+
+/*
+ * acllh.l is compiled twice: once with every output sink and once with
+ * ACLLH_STATS_ONLY, where the sinks are compiled out and only the counters
+ * remain. The driver picks one of the two entry tables.
+ */
+struct acllh_backend {
+    int output;                 // 0 when the build writes neither text nor log
+    int (*ctx_init)(struct acllh_ctx *ctx);
+    void (*ctx_destroy)(struct acllh_ctx *ctx);
+    int (*scan_file)(struct acllh_ctx *ctx, const char *path);
+    int (*scan_buffer)(struct acllh_ctx *ctx, const char *path, char *base, size_t size);
+    void (*scan_stream)(struct acllh_ctx *ctx, FILE *f);
+    int (*scan_chunk)(struct acllh_ctx *ctx, const char *base, size_t len, size_t offset,
+                      int lineno, enum acllh_state state, int flags);
+};
+
+/* acllh.l */
+extern const struct acllh_backend acllh_full_backend;
+extern const struct acllh_backend acllh_stats_backend;
+#ifdef ACLLH_PROFILE
+extern const char *const acllh_rule_names[ACLLH_PROFILE_RULES];
+#endif
+
+/* acllh.c */
+void acllh_stats_merge(struct acllh_stats *to, const struct acllh_stats *from);
+int acllh_stats_json(char *buf, size_t size, const struct acllh_stats *s);
+
+/* serve.c */
+int acllh_serve(const char *path, int workers, const struct acllh_backend *backend,
+                const struct out_style *style);
+
+/* watch.c */
+void acllh_lines_grow(struct acllh_lines *l);
+int acllh_watch(char **paths, int n, const struct out_style *style);
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ *      Micro-benchmark: linear strcmp scan vs. generated keyword hash
+ *
+ *      Collects every identifier-shaped word from the given files and
+ *      classifies the whole list repeatedly with both lookups.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "keywords.h"
+
+#define ROUNDS                  200
+
+static const char *reserved_words[RESERVED_WORDS_NUM] = {
+#define RESERVED_WORD(s) s,
+#include "keywords.def"
+#undef RESERVED_WORD
+};
+
+static int linear_reserved_word_id(const char *word) {
+    for(int i = 0; i < RESERVED_WORDS_NUM; ++i) {
+        if(!strcmp(word, reserved_words[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+struct word {
+    char *s;
+    int len;
+};
+
+static struct word *words;
+static int nwords, maxwords;
+
+static void add_word(const char *s, int len) {
+    if(nwords == maxwords) {
+        maxwords = maxwords ? maxwords * 2 : 4096;
+        words = realloc(words, maxwords * sizeof(struct word));
+        if(!words) {
+            fprintf(stderr, "out of space\n");
+            exit(1);
+        }
+    }
+    words[nwords].s = strndup(s, len);
+    words[nwords].len = len;
+    nwords++;
+}
+
+static void collect(FILE *f) {
+    char buf[256];
+    int len = 0, c;
+
+    while((c = getc(f)) != EOF) {
+        if(isalnum(c) || c == '_') {
+            if(len || !isdigit(c)) {
+                if(len < (int)sizeof(buf)) buf[len++] = c;
+                continue;
+            }
+        }
+        if(len) add_word(buf, len);
+        len = 0;
+    }
+    if(len) add_word(buf, len);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    int i, r;
+    long hits_linear = 0, hits_hash = 0;
+    double t0, t1, t2;
+
+    for(i = 1; i < argc; ++i) {
+        FILE *f = fopen(argv[i], "r");
+        if(!f) {
+            perror(argv[i]);
+            continue;
+        }
+        collect(f);
+        fclose(f);
+    }
+
+    if(!nwords) {
+        fprintf(stderr, "usage: %s file ...\n", argv[0]);
+        return 1;
+    }
+
+    t0 = now();
+    for(r = 0; r < ROUNDS; ++r) {
+        for(i = 0; i < nwords; ++i) {
+            hits_linear += linear_reserved_word_id(words[i].s) >= 0;
+        }
+    }
+    t1 = now();
+    for(r = 0; r < ROUNDS; ++r) {
+        for(i = 0; i < nwords; ++i) {
+            hits_hash += get_reserved_word_id(words[i].s, words[i].len) >= 0;
+        }
+    }
+    t2 = now();
+
+    if(hits_linear != hits_hash) {
+        fprintf(stderr, "mismatch: linear %ld, hash %ld\n", hits_linear, hits_hash);
+        return 1;
+    }
+
+    printf("%d words x %d rounds, %ld reserved\n", nwords, ROUNDS, hits_hash / ROUNDS);
+    printf("linear scan:   %6.2f ns/word\n", (t1 - t0) * 1e9 / ((double)nwords * ROUNDS));
+    printf("perfect hash:  %6.2f ns/word\n", (t2 - t1) * 1e9 / ((double)nwords * ROUNDS));
+
+    return 0;
+}
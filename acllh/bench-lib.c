@@ -0,0 +1,158 @@
+/*
+ *      Library benchmark: libacllh against the acllh executable
+ *
+ *      The given files are concatenated up to MIN_BYTES and lexed
+ *      through the library in batches of BATCH tokens. For comparison
+ *      the same input goes through acllh writing the token stream (-b)
+ *      and counting only (--stats-only). The library's tokens are
+ *      checked against output.tok first; block comments and strings,
+ *      which only the library reports, are skipped in that check.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libacllh.h"
+
+#define MIN_BYTES               (16 * 1024 * 1024)
+#define BATCH                   4096
+#define INPUT                   "bench-lib.input.c"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *load(int argc, char **argv, size_t *len) {
+    size_t cap = 1 << 20, n = 0, one;
+    char *buf = malloc(cap);
+    int i;
+
+    for(i = 2; i < argc; ++i) {
+        FILE *f = fopen(argv[i], "rb");
+        size_t r;
+
+        if(!f) {
+            perror(argv[i]);
+            exit(1);
+        }
+        while((r = fread(buf + n, 1, cap - n, f)) > 0) {
+            n += r;
+            if(n == cap) buf = realloc(buf, cap *= 2);
+        }
+        fclose(f);
+    }
+    for(one = n; one && n < MIN_BYTES; n += one) {
+        while(n + one > cap) buf = realloc(buf, cap *= 2);
+        memcpy(buf + n, buf, one);
+    }
+    *len = n;
+    return buf;
+}
+
+/* only the library reports these */
+static int library_only(const char *buf, const struct acllh_tokens *t, size_t i) {
+    const char *p = buf + t->offsets[i];
+
+    return (t->kinds[i] == TOK_COMMENT && p[1] == '*') || (t->kinds[i] == TOK_CONSTANT && *p == '"');
+}
+
+static long check(struct acllh_lexer *lx, const char *buf, size_t len, struct acllh_tokens *t) {
+    struct tok_stream ts;
+    const struct tok_record *r;
+    uint64_t k = 0;
+    long tokens = 0;
+    size_t i;
+
+    if(tok_open(&ts, "output.tok") < 0 || ts.nfiles != 1) {
+        fprintf(stderr, "bench-lib: no output.tok for %s\n", INPUT);
+        exit(1);
+    }
+    r = ts.files[0].records;
+    acllh_lexer_reset(lx, buf, len);
+    while(acllh_lexer_next(lx, t)) {
+        for(i = 0; i < t->n; ++i, ++tokens) {
+            if(library_only(buf, t, i)) continue;
+            if(k == ts.files[0].nrecords || r[k].kind != t->kinds[i] || r[k].id != t->ids[i]
+               || r[k].offset != t->offsets[i] || r[k].length != t->lengths[i] || r[k].line != t->lines[i]) {
+                fprintf(stderr, "bench-lib: token %lu differs from output.tok at line %u\n",
+                        (unsigned long)k, t->lines[i]);
+                exit(1);
+            }
+            k++;
+        }
+    }
+    if(k != ts.files[0].nrecords) {
+        fprintf(stderr, "bench-lib: output.tok has %lu tokens more\n", (unsigned long)(ts.files[0].nrecords - k));
+        exit(1);
+    }
+    tok_close(&ts);
+    return tokens;
+}
+
+static double run(const char *acllh, const char *options) {
+    char cmd[4096];
+    double start = now();
+
+    snprintf(cmd, sizeof(cmd), "%s -t %s %s > /dev/null", acllh, options, INPUT);
+    if(system(cmd)) {
+        fprintf(stderr, "bench-lib: %s failed\n", cmd);
+        exit(1);
+    }
+    return now() - start;
+}
+
+static void report(const char *name, size_t len, long tokens, double t) {
+    printf("%-22s %8.1f MB/s %8.2f Mtokens/s\n", name, len / 1e6 / t, tokens / 1e6 / t);
+}
+
+int main(int argc, char **argv) {
+    struct acllh_lexer *lx = acllh_lexer_create();
+    struct acllh_tokens t;
+    size_t len;
+    char *buf;
+    FILE *f;
+    long tokens;
+    double start, cli_tok, cli_stats, lib;
+    char name[32];
+
+    if(argc < 3) {
+        fprintf(stderr, "usage: %s acllh file ...\n", argv[0]);
+        return 1;
+    }
+    buf = load(argc, argv, &len);
+    if(!lx || !(f = fopen(INPUT, "wb")) || fwrite(buf, 1, len, f) != len || fclose(f)) {
+        perror(INPUT);
+        return 1;
+    }
+
+    t.kinds = malloc(BATCH * sizeof(*t.kinds));
+    t.ids = malloc(BATCH * sizeof(*t.ids));
+    t.offsets = malloc(BATCH * sizeof(*t.offsets));
+    t.lengths = malloc(BATCH * sizeof(*t.lengths));
+    t.lines = malloc(BATCH * sizeof(*t.lines));
+    t.cap = BATCH;
+
+    cli_tok = run(argv[1], "-b");
+    tokens = check(lx, buf, len, &t);
+    cli_stats = run(argv[1], "--stats-only");
+
+    start = now();
+    acllh_lexer_reset(lx, buf, len);
+    while(acllh_lexer_next(lx, &t));
+    lib = now() - start;
+
+    printf("%.1f MB, %ld tokens\n", len / 1e6, tokens);
+    report("acllh -b", len, tokens, cli_tok);
+    report("acllh --stats-only", len, tokens, cli_stats);
+    snprintf(name, sizeof(name), "libacllh (%s)", acllh_scanner);
+    report(name, len, tokens, lib);
+
+    remove(INPUT);
+    remove("output.tok");
+    acllh_lexer_destroy(lx);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ *      Server mode benchmark
+ *
+ *      Sends FILE requests for the given files round-robin over one
+ *      connection and reports the client-side latency, then the server's
+ *      own STATS line. For comparison, the same files are highlighted
+ *      by starting one acllh process each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define REQUESTS                2000
+#define SPAWNS                  200
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *what, double *lat, int n) {
+    qsort(lat, n, sizeof(double), cmp_double);
+    printf("%-8s %5d requests   p50 %8.1f us   p99 %8.1f us\n", what, n,
+           lat[(n - 1) / 2] * 1e6, lat[(n - 1) * 99 / 100] * 1e6);
+}
+
+/* read one response; the text is skipped, the JSON line is kept in json */
+static int read_response(FILE *in, char *json, size_t size) {
+    char head[256];
+    size_t len;
+
+    if(!fgets(head, sizeof(head), in) || sscanf(head, "OK %zu", &len) != 1) {
+        fprintf(stderr, "bad response: %s", head);
+        return -1;
+    }
+    while(len > 0) {
+        char skip[65536];
+        size_t n = fread(skip, 1, len < sizeof(skip) ? len : sizeof(skip), in);
+
+        if(!n) return -1;
+        len -= n;
+    }
+    return fgets(json, size, in) ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    struct sockaddr_un addr;
+    double *lat = malloc(REQUESTS * sizeof(double));
+    char json[4096];
+    FILE *in;
+    int fd, i;
+
+    if(argc < 4) {
+        fprintf(stderr, "usage: %s socket acllh file ...\n", argv[0]);
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    in = fdopen(dup(fd), "r");
+
+    for(i = 0; i < REQUESTS; ++i) {
+        double start = now();
+
+        dprintf(fd, "FILE %s\n", argv[3 + i % (argc - 3)]);
+        if(read_response(in, json, sizeof(json)) < 0) return 1;
+        lat[i] = now() - start;
+    }
+    report("server", lat, REQUESTS);
+
+    dprintf(fd, "STATS\n");
+    if(read_response(in, json, sizeof(json)) < 0) return 1;
+    printf("server says: %s", json);
+    fclose(in);
+    close(fd);
+    fflush(stdout);
+
+    for(i = 0; i < SPAWNS; ++i) {
+        double start = now();
+        pid_t pid = fork();
+
+        if(pid == 0) {
+            if(!freopen("/dev/null", "w", stdout)) _exit(1);
+            execl(argv[2], argv[2], "-t", argv[3 + i % (argc - 3)], (char *)NULL);
+            _exit(127);
+        }
+        waitpid(pid, NULL, 0);
+        lat[i] = now() - start;
+    }
+    report("spawn", lat, SPAWNS);
+
+    free(lat);
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ *      Span kernel benchmark: scalar against SSE2 and AVX2
+ *
+ *      Every kernel walks the concatenated input from run to run, the
+ *      way the scanner does in the matching state, and the throughput in
+ *      MB/s is printed. The blank kernel only ever sees indentation, so it
+ *      walks the leading blanks of every line. The vector results are
+ *      checked against the scalar ones first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "span.h"
+
+#define MIN_BYTES               (64 * 1024 * 1024)
+
+static char *load(int argc, char **argv, size_t *len) {
+    size_t cap = 1 << 20, n = 0;
+    char *buf = malloc(cap);
+    int i;
+
+    for(i = 1; i < argc; ++i) {
+        FILE *f = fopen(argv[i], "rb");
+        size_t r;
+
+        if(!f) {
+            perror(argv[i]);
+            exit(1);
+        }
+        while((r = fread(buf + n, 1, cap - n, f)) > 0) {
+            n += r;
+            if(n == cap) buf = realloc(buf, cap *= 2);
+        }
+        fclose(f);
+    }
+    *len = n;
+    return buf;
+}
+
+/* the leading blanks of every line, each run closed by its newline */
+static char *indentation(const char *buf, size_t len, size_t *out_len) {
+    char *ind = malloc(len + 1);
+    const char *p = buf, *end = buf + len;
+    size_t n = 0;
+
+    while(p < end) {
+        while(p < end && (*p == ' ' || *p == '\t')) ind[n++] = *p++;
+        ind[n++] = '\n';
+        while(p < end && *p++ != '\n');
+    }
+    *out_len = n;
+    return ind;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* run from stop to stop over the whole buffer, return the number of runs */
+static long walk(span_fn fn, const char *p, const char *end) {
+    long runs = 0;
+
+    while(p < end) {
+        p += fn(p, end) + 1;
+        runs++;
+    }
+    return runs;
+}
+
+static void bench(const char *kind, const struct span_kernels *k, span_fn fn, span_fn ref,
+                  const char *buf, size_t len) {
+    const char *p;
+    double start, secs;
+    long runs = 0, rounds = 0;
+
+    for(p = buf; p < buf + len; ++p) {
+        if(fn(p, buf + len) != ref(p, buf + len)) {
+            fprintf(stderr, "%s/%s: mismatch at offset %ld\n", k->name, kind, (long)(p - buf));
+            exit(1);
+        }
+    }
+
+    start = now();
+    do {
+        runs += walk(fn, buf, buf + len);
+        rounds++;
+    } while(rounds * len < MIN_BYTES);
+    secs = now() - start;
+
+    printf("%-8s %-8s %8.1f MB/s   %6.1f bytes/run\n", k->name, kind,
+           rounds * len / 1e6 / secs, (double)rounds * len / runs);
+}
+
+static void bench_set(const struct span_kernels *k, const char *buf, size_t len,
+                      const char *ind, size_t ind_len) {
+    bench("comment", k, k->comment, span_scalar.comment, buf, len);
+    bench("string", k, k->string, span_scalar.string, buf, len);
+    bench("line", k, k->line, span_scalar.line, buf, len);
+    bench("blank", k, k->blank, span_scalar.blank, ind, ind_len);
+}
+
+int main(int argc, char **argv) {
+    size_t len, ind_len;
+    char *buf, *ind;
+
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s file ...\n", argv[0]);
+        return 1;
+    }
+    buf = load(argc, argv, &len);
+    ind = indentation(buf, len, &ind_len);
+
+    bench_set(&span_scalar, buf, len, ind, ind_len);
+#ifdef SPAN_X86
+    bench_set(&span_sse2, buf, len, ind, ind_len);
+    if(span_best() == &span_avx2) bench_set(&span_avx2, buf, len, ind, ind_len);
+#endif
+    printf("selected: %s\n", span_best()->name);
+
+    free(ind);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,377 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "cache.h"
+
+// bumped by the makefile whenever acllh.l, keywords.def or output.c change
+#ifndef ACLLH_RULES_VERSION
+#define ACLLH_RULES_VERSION     0
+#endif
+
+#define CACHE_MAGIC             "ACLC"
+#define CACHE_VERSION           3
+#define CACHE_NAME_LEN          16      // hex digits of the key
+#define CACHE_TMP_PREFIX        ".tmp-"
+#define CACHE_TMP_MAX_AGE       3600    // seconds before a leftover temporary is removed
+
+struct cache_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint64_t text_len;
+    uint64_t log_len;
+    uint64_t idents_len;
+    uint64_t xref_len;
+    int64_t records;
+    struct acllh_stats stats;
+};
+
+struct cache_file {
+    char *name;
+    off_t size;
+    struct timespec mtime;
+};
+
+/*
+ * 64-bit hash, four independent lanes of 8 bytes each so the multiplies
+ * overlap; the rounds and the final mix are those of XXH64.
+ */
+#define P1                      0x9e3779b185ebca87ULL
+#define P2                      0xc2b2ae3d27d4eb4fULL
+#define P3                      0x165667b19e3779f9ULL
+#define P4                      0x85ebca77c2b2ae63ULL
+#define P5                      0x27d4eb2f165667c5ULL
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t load64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t v) {
+    return rotl(acc + v * P2, 31) * P1;
+}
+
+static inline uint64_t merge64(uint64_t h, uint64_t v) {
+    return (h ^ round64(0, v)) * P1 + P4;
+}
+
+static uint64_t hash_bytes(const void *data, size_t n, uint64_t seed) {
+    const unsigned char *p = data, *end = p + n;
+    uint64_t h;
+
+    if(n >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+
+        for(; end - p >= 32; p += 32) {
+            v1 = round64(v1, load64(p));
+            v2 = round64(v2, load64(p + 8));
+            v3 = round64(v3, load64(p + 16));
+            v4 = round64(v4, load64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge64(h, v1);
+        h = merge64(h, v2);
+        h = merge64(h, v3);
+        h = merge64(h, v4);
+    } else {
+        h = seed + P5;
+    }
+    h += n;
+
+    for(; end - p >= 8; p += 8) h = rotl(h ^ round64(0, load64(p)), 27) * P1 + P4;
+    for(; p < end; ++p) h = rotl(h ^ (*p * P5), 11) * P1;
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+static void entry_path(const struct acllh_cache *c, uint64_t key, const char *suffix,
+                       char *buf, size_t size) {
+    snprintf(buf, size, "%s/%016llx%s%s", c->dir, (unsigned long long)key,
+             suffix ? "." : "", suffix ? suffix : "");
+}
+
+int cache_open(struct acllh_cache *c, const char *dir, size_t max_bytes, const char *options) {
+    char salt[256];
+    int n;
+
+    if(mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror(dir);
+        return -1;
+    }
+    c->dir = strdup(dir);
+    if(!c->dir) return -1;
+    c->max_bytes = max_bytes;
+
+    n = snprintf(salt, sizeof(salt), "rules %lu, stats %zu, %s",
+                 (unsigned long)ACLLH_RULES_VERSION, sizeof(struct acllh_stats), options);
+    c->salt = hash_bytes(salt, n, CACHE_VERSION);
+    return 0;
+}
+
+void cache_close(struct acllh_cache *c) {
+    free(c->dir);
+    c->dir = NULL;
+}
+
+/* key of a regular file as it is now; -1 if it cannot be cached */
+int cache_key(const struct acllh_cache *c, const char *path, uint64_t *key) {
+    struct stat st;
+    uint64_t seed = hash_bytes(path, strlen(path), c->salt);
+    void *base;
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0) return -1;
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    if(!st.st_size) {
+        close(fd);
+        *key = hash_bytes(NULL, 0, seed);
+        return 0;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) return -1;
+    *key = hash_bytes(base, st.st_size, seed);
+    munmap(base, st.st_size);
+    return 0;
+}
+
+int cache_load(const struct acllh_cache *c, uint64_t key, struct cache_entry *e) {
+    char path[4096];
+    struct cache_header h;
+    struct stat st;
+    int fd;
+
+    entry_path(c, key, NULL, path, sizeof(path));
+    fd = open(path, O_RDONLY);
+    if(fd < 0) return -1;
+
+    if(fstat(fd, &st) < 0
+       || pread(fd, &h, sizeof(h), 0) != sizeof(h)
+       || memcmp(h.magic, CACHE_MAGIC, 4) || h.version != CACHE_VERSION || h.key != key
+       || (uint64_t)st.st_size != sizeof(h) + h.text_len + h.log_len + h.idents_len + h.xref_len) {
+        close(fd);
+        return -1;
+    }
+
+    e->text = malloc(h.text_len ? h.text_len : 1);
+    e->log = malloc(h.log_len ? h.log_len : 1);
+    e->idents = malloc(h.idents_len ? h.idents_len : 1);
+    e->xref = malloc(h.xref_len ? h.xref_len : 1);
+    if(!e->text || !e->log || !e->idents || !e->xref
+       || pread(fd, e->text, h.text_len, sizeof(h)) != (ssize_t)h.text_len
+       || pread(fd, e->log, h.log_len, sizeof(h) + h.text_len) != (ssize_t)h.log_len
+       || pread(fd, e->idents, h.idents_len, sizeof(h) + h.text_len + h.log_len)
+          != (ssize_t)h.idents_len
+       || pread(fd, e->xref, h.xref_len, sizeof(h) + h.text_len + h.log_len + h.idents_len)
+          != (ssize_t)h.xref_len) {
+        free(e->text);
+        free(e->log);
+        free(e->idents);
+        free(e->xref);
+        close(fd);
+        return -1;
+    }
+    e->text_len = h.text_len;
+    e->log_len = h.log_len;
+    e->idents_len = h.idents_len;
+    e->xref_len = h.xref_len;
+    e->records = h.records;
+    e->stats = h.stats;
+
+    // recently used: eviction goes by mtime
+    futimens(fd, NULL);
+    close(fd);
+    return 0;
+}
+
+static int write_full(int fd, const void *s, size_t n) {
+    const char *p = s;
+
+    while(n > 0) {
+        ssize_t w = write(fd, p, n);
+
+        if(w < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+/* write the pieces to a temporary and rename it into place; best effort */
+static void publish(const struct acllh_cache *c, const char *path, const struct iovec *iov, int n) {
+    static unsigned long serial;
+    char tmp[4096];
+    int fd, i;
+
+    snprintf(tmp, sizeof(tmp), "%s/" CACHE_TMP_PREFIX "%ld-%lu", c->dir, (long)getpid(),
+             __atomic_fetch_add(&serial, 1, __ATOMIC_RELAXED));
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if(fd < 0) return;
+    for(i = 0; i < n; ++i) {
+        if(write_full(fd, iov[i].iov_base, iov[i].iov_len) < 0) break;
+    }
+    if(close(fd) < 0 || i < n || rename(tmp, path) < 0) unlink(tmp);
+}
+
+/* a failed store only costs the next run a re-lex */
+void cache_store(const struct acllh_cache *c, uint64_t key, const struct cache_entry *e) {
+    char path[4096];
+    struct cache_header h;
+    struct iovec iov[5];
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_MAGIC, 4);
+    h.version = CACHE_VERSION;
+    h.key = key;
+    h.text_len = e->text_len;
+    h.log_len = e->log_len;
+    h.idents_len = e->idents ? e->idents_len : 0;
+    h.xref_len = e->xref ? e->xref_len : 0;
+    h.records = e->records;
+    h.stats = e->stats;
+
+    iov[0].iov_base = &h;
+    iov[0].iov_len = sizeof(h);
+    iov[1].iov_base = e->text;
+    iov[1].iov_len = e->text_len;
+    iov[2].iov_base = e->log;
+    iov[2].iov_len = e->log_len;
+    iov[3].iov_base = e->idents;
+    iov[3].iov_len = h.idents_len;
+    iov[4].iov_base = e->xref;
+    iov[4].iov_len = h.xref_len;
+
+    entry_path(c, key, NULL, path, sizeof(path));
+    publish(c, path, iov, 5);
+}
+
+/*
+ * Side files live next to the entry of the same key, "<key>.<suffix>",
+ * and are evicted with the same LRU; their contents are up to the caller.
+ */
+char *cache_load_side(const struct acllh_cache *c, uint64_t key, const char *suffix, size_t *len) {
+    char path[4096];
+    struct stat st;
+    char *data;
+    int fd;
+
+    entry_path(c, key, suffix, path, sizeof(path));
+    fd = open(path, O_RDONLY);
+    if(fd < 0) return NULL;
+    if(fstat(fd, &st) < 0 || !(data = malloc(st.st_size ? st.st_size : 1))) {
+        close(fd);
+        return NULL;
+    }
+    if(pread(fd, data, st.st_size, 0) != st.st_size) {
+        free(data);
+        close(fd);
+        return NULL;
+    }
+    futimens(fd, NULL);
+    close(fd);
+    *len = st.st_size;
+    return data;
+}
+
+void cache_store_side(const struct acllh_cache *c, uint64_t key, const char *suffix,
+                      const void *data, size_t len) {
+    char path[4096];
+    struct iovec iov;
+
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+    entry_path(c, key, suffix, path, sizeof(path));
+    publish(c, path, &iov, 1);
+}
+
+/* "<key>" or "<key>.<suffix>" */
+static int is_entry_name(const char *name) {
+    int i;
+
+    for(i = 0; i < CACHE_NAME_LEN; ++i) {
+        if(!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f'))) return 0;
+    }
+    return name[i] == '\0' || name[i] == '.';
+}
+
+static int cmp_mtime(const void *a, const void *b) {
+    const struct timespec *x = &((const struct cache_file *)a)->mtime;
+    const struct timespec *y = &((const struct cache_file *)b)->mtime;
+
+    if(x->tv_sec != y->tv_sec) return (x->tv_sec > y->tv_sec) - (x->tv_sec < y->tv_sec);
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/*
+ * Evict the least recently used entries until the directory fits
+ * max_bytes. Runs trimming concurrently may both unlink an entry;
+ * the loser's unlink simply fails.
+ */
+void cache_trim(const struct acllh_cache *c) {
+    struct dirent **names;
+    struct cache_file *files;
+    size_t total = 0;
+    time_t now = time(NULL);
+    int i, n, nfiles = 0;
+
+    n = scandir(c->dir, &names, NULL, NULL);
+    if(n < 0) return;
+    files = calloc(n ? n : 1, sizeof(struct cache_file));
+
+    for(i = 0; i < n; ++i) {
+        char path[4096];
+        struct stat st;
+        const char *name = names[i]->d_name;
+
+        snprintf(path, sizeof(path), "%s/%s", c->dir, name);
+        if(!strncmp(name, CACHE_TMP_PREFIX, strlen(CACHE_TMP_PREFIX))) {
+            // left behind by a run that died before its rename
+            if(!stat(path, &st) && now - st.st_mtime > CACHE_TMP_MAX_AGE) unlink(path);
+        } else if(files && is_entry_name(name) && !stat(path, &st)) {
+            files[nfiles].name = names[i]->d_name;
+            files[nfiles].size = st.st_size;
+            files[nfiles].mtime = st.st_mtim;
+            total += st.st_size;
+            nfiles++;
+        }
+    }
+
+    if(files && total > c->max_bytes) {
+        qsort(files, nfiles, sizeof(struct cache_file), cmp_mtime);
+        for(i = 0; i < nfiles && total > c->max_bytes; ++i) {
+            char path[4096];
+
+            snprintf(path, sizeof(path), "%s/%s", c->dir, files[i].name);
+            if(!unlink(path)) total -= files[i].size;
+        }
+    }
+
+    free(files);
+    for(i = 0; i < n; ++i) free(names[i]);
+    free(names);
+}
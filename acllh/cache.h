@@ -0,0 +1,52 @@
+#ifndef __ACLLH_CACHE_H
+#define __ACLLH_CACHE_H
+
+/*
+ *      On-disk cache of highlighted files
+ *
+ *      An entry holds everything one scan_file() produces: the text, the
+ *      log, the counters and, with --top or --xref, the identifier counts or
+ *      locations. It is named after a 64-bit hash of the file
+ *      contents, seeded with the path (which appears in the output) and a
+ *      salt covering the rule set of this build and the output options.
+ *
+ *      Entries are written to a temporary name and renamed into place, so
+ *      concurrent runs only ever see complete entries. A hit touches the
+ *      entry's mtime; cache_trim() evicts the least recently used entries
+ *      until the directory fits its size bound.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "acllh.h"
+
+struct acllh_cache {
+    char *dir;
+    size_t max_bytes;
+    uint64_t salt;
+};
+
+struct cache_entry {
+    char *text;
+    char *log;
+    size_t text_len;
+    size_t log_len;
+    char *idents;               // intern_pack() of the file's identifiers, NULL if not counted
+    size_t idents_len;
+    char *xref;                 // xref_file_pack() of the file's identifiers, NULL if not indexed
+    size_t xref_len;
+    long records;
+    struct acllh_stats stats;
+};
+
+int cache_open(struct acllh_cache *c, const char *dir, size_t max_bytes, const char *options);
+void cache_close(struct acllh_cache *c);
+int cache_key(const struct acllh_cache *c, const char *path, uint64_t *key);
+int cache_load(const struct acllh_cache *c, uint64_t key, struct cache_entry *e);
+void cache_store(const struct acllh_cache *c, uint64_t key, const struct cache_entry *e);
+char *cache_load_side(const struct acllh_cache *c, uint64_t key, const char *suffix, size_t *len);
+void cache_store_side(const struct acllh_cache *c, uint64_t key, const char *suffix,
+                      const void *data, size_t len);
+void cache_trim(const struct acllh_cache *c);
+
+#endif
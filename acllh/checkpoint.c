@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "acllh.h"
+#include "checkpoint.h"
+
+struct checkpoint_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t every;
+    uint32_t n;
+    uint64_t size;
+};
+
+static void *checkpoint_alloc(size_t size) {
+    void *m = calloc(1, size ? size : 1);
+    if(!m) {
+        perror("acllh");
+        exit(1);
+    }
+    return m;
+}
+
+/* a statistics-only scanner: it only has to find out the state lines end in */
+static struct acllh_ctx *skip_ctx(void) {
+    struct acllh_ctx *ctx = checkpoint_alloc(sizeof(struct acllh_ctx));
+
+    if(acllh_stats_backend.ctx_init(ctx) < 0) {
+        perror("acllh");
+        exit(1);
+    }
+    out_init_mem(&ctx->text);
+    out_init_mem(&ctx->log);
+    return ctx;
+}
+
+static void skip_ctx_free(struct acllh_ctx *ctx) {
+    size_t len;
+
+    acllh_stats_backend.ctx_destroy(ctx);
+    free(out_take(&ctx->text, &len));
+    free(out_take(&ctx->log, &len));
+    free(ctx);
+}
+
+/* the end of the n-th line from p on, or end if the file runs out first */
+static const char *skip_lines(const char *p, const char *end, long n) {
+    while(n-- > 0 && p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+
+        p = nl ? nl + 1 : end;
+    }
+    return p;
+}
+
+/* just line 1, for a single lookup that does not pay for a full pass */
+void checkpoints_origin(struct checkpoints *cp, size_t size) {
+    cp->v = checkpoint_alloc(sizeof(struct checkpoint));
+    cp->v[0].line = 1;
+    cp->n = 1;
+    cp->size = size;
+}
+
+void checkpoints_build(struct checkpoints *cp, const char *base, size_t size) {
+    struct acllh_ctx *ctx = skip_ctx();
+    const char *p = base, *end = base + size;
+    size_t cap = 64;
+
+    checkpoints_origin(cp, size);
+    cp->v = realloc(cp->v, cap * sizeof(struct checkpoint));
+    if(!cp->v) {
+        perror("acllh");
+        exit(1);
+    }
+
+    for(;;) {
+        const struct checkpoint *last = &cp->v[cp->n - 1];
+        const char *next = skip_lines(p, end, CHECKPOINT_LINES);
+        struct checkpoint *c;
+        int state;
+
+        // a checkpoint only helps if its line exists
+        if(next == end) break;
+        state = acllh_stats_backend.scan_chunk(ctx, p, next - p, p - base, last->line,
+                                               last->state, 0);
+        if(cp->n == cap) {
+            cp->v = realloc(cp->v, (cap *= 2) * sizeof(struct checkpoint));
+            if(!cp->v) {
+                perror("acllh");
+                exit(1);
+            }
+        }
+        c = &cp->v[cp->n++];
+        c->offset = next - base;
+        c->line = last->line + CHECKPOINT_LINES;
+        c->state = state;
+        p = next;
+    }
+
+    skip_ctx_free(ctx);
+}
+
+void checkpoints_free(struct checkpoints *cp) {
+    free(cp->v);
+    cp->v = NULL;
+    cp->n = 0;
+}
+
+char *checkpoints_pack(const struct checkpoints *cp, size_t *len) {
+    struct checkpoint_header h;
+    char *blob;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CHECKPOINT_MAGIC, 4);
+    h.version = CHECKPOINT_VERSION;
+    h.every = CHECKPOINT_LINES;
+    h.n = cp->n;
+    h.size = cp->size;
+
+    *len = sizeof(h) + cp->n * sizeof(struct checkpoint);
+    blob = checkpoint_alloc(*len);
+    memcpy(blob, &h, sizeof(h));
+    memcpy(blob + sizeof(h), cp->v, cp->n * sizeof(struct checkpoint));
+    return blob;
+}
+
+/* -1 unless the blob is a whole list made for a file of this size */
+int checkpoints_unpack(struct checkpoints *cp, const char *blob, size_t len, size_t size) {
+    struct checkpoint_header h;
+
+    if(len < sizeof(h)) return -1;
+    memcpy(&h, blob, sizeof(h));
+    if(memcmp(h.magic, CHECKPOINT_MAGIC, 4) || h.version != CHECKPOINT_VERSION
+       || h.every != CHECKPOINT_LINES || h.size != size || !h.n
+       || len != sizeof(h) + (size_t)h.n * sizeof(struct checkpoint)) {
+        return -1;
+    }
+    cp->v = checkpoint_alloc(h.n * sizeof(struct checkpoint));
+    memcpy(cp->v, blob + sizeof(h), h.n * sizeof(struct checkpoint));
+    cp->n = h.n;
+    cp->size = size;
+    return 0;
+}
+
+/*
+ * Find where a line starts and the state it starts in: binary search
+ * for the last checkpoint at or before it, then lex the lines between.
+ * A line past the end of the file starts at its end.
+ */
+int checkpoints_seek(const struct checkpoints *cp, const char *base, int line, size_t *offset) {
+    const struct checkpoint *c;
+    const char *from, *to;
+    size_t lo = 0, hi = cp->n;
+    int state;
+
+    while(hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if(cp->v[mid].line <= (uint32_t)line) lo = mid;
+        else hi = mid;
+    }
+    c = &cp->v[lo];
+    from = base + c->offset;
+    to = skip_lines(from, base + cp->size, line - (long)c->line);
+    *offset = to - base;
+
+    state = c->state;
+    if(to > from) {
+        struct acllh_ctx *ctx = skip_ctx();
+
+        state = acllh_stats_backend.scan_chunk(ctx, from, to - from, c->offset, c->line, state, 0);
+        skip_ctx_free(ctx);
+    }
+    return state;
+}
@@ -0,0 +1,43 @@
+#ifndef __ACLLH_CHECKPOINT_H
+#define __ACLLH_CHECKPOINT_H
+
+/*
+ *      Line checkpoints for random access into a file
+ *
+ *      Every CHECKPOINT_LINES lines the byte offset, the line number and
+ *      the start condition the line begins in are recorded. Tokens never
+ *      span a newline except inside block comments and strings, which the
+ *      start condition covers, so lexing can resume at any checkpoint.
+ *
+ *      Building the list takes one pass of the statistics-only scanner.
+ *      To reach a line, checkpoints_seek() lexes from the nearest
+ *      checkpoint before it, again without output.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHECKPOINT_LINES        1024
+#define CHECKPOINT_MAGIC        "ACLK"
+#define CHECKPOINT_VERSION      1
+
+struct checkpoint {
+    uint64_t offset;            // first byte of the line
+    uint32_t line;
+    uint32_t state;             // enum acllh_state
+};
+
+struct checkpoints {
+    struct checkpoint *v;       // v[0] is always line 1
+    size_t n;
+    uint64_t size;              // of the file they belong to
+};
+
+void checkpoints_origin(struct checkpoints *cp, size_t size);
+void checkpoints_build(struct checkpoints *cp, const char *base, size_t size);
+void checkpoints_free(struct checkpoints *cp);
+char *checkpoints_pack(const struct checkpoints *cp, size_t *len);
+int checkpoints_unpack(struct checkpoints *cp, const char *blob, size_t len, size_t size);
+int checkpoints_seek(const struct checkpoints *cp, const char *base, int line, size_t *offset);
+
+#endif
@@ -0,0 +1,273 @@
+#define _GNU_SOURCE             // fopencookie
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef ACLLH_ZSTD
+#include <zstd.h>
+#endif
+#include "decompress.h"
+
+static const struct {
+    const char *suffix;
+    enum decomp_kind kind;
+} suffixes[] = {
+    { ".gz", DECOMP_GZIP },
+#ifdef ACLLH_ZSTD
+    { ".zst", DECOMP_ZSTD },
+#endif
+    { NULL, DECOMP_NONE },
+};
+
+enum decomp_kind decomp_kind(const char *path) {
+    const char *dot = strrchr(path, '.');
+    int i;
+
+    if(!dot) return DECOMP_NONE;
+    for(i = 0; suffixes[i].suffix; ++i) {
+        if(!strcmp(dot, suffixes[i].suffix)) return suffixes[i].kind;
+    }
+    return DECOMP_NONE;
+}
+
+const char *decomp_name(enum decomp_kind kind) {
+    return kind == DECOMP_ZSTD ? "zstd" : "gzip";
+}
+
+/* the next empty slot, once there is one; NULL when the reader went away */
+static char *slot_get(struct decomp *d) {
+    char *data;
+
+    pthread_mutex_lock(&d->lock);
+    while(d->count == DECOMP_SLOTS && !d->closing) pthread_cond_wait(&d->drained, &d->lock);
+    data = d->closing ? NULL : d->slots[(d->head + d->count) % DECOMP_SLOTS].data;
+    pthread_mutex_unlock(&d->lock);
+    return data;
+}
+
+static void slot_put(struct decomp *d, size_t len) {
+    if(!len) return;
+    pthread_mutex_lock(&d->lock);
+    d->slots[(d->head + d->count) % DECOMP_SLOTS].len = len;
+    d->count++;
+    d->out_bytes += len;
+    pthread_cond_signal(&d->filled);
+    pthread_mutex_unlock(&d->lock);
+}
+
+/* 0 at the end of the file */
+static ssize_t read_input(struct decomp *d, void *buf) {
+    ssize_t n;
+
+    do {
+        n = read(d->fd, buf, DECOMP_READ_SIZE);
+    } while(n < 0 && errno == EINTR);
+    if(n > 0) d->in_bytes += n;
+    return n;
+}
+
+/* gzip or zlib data, any number of gzip members back to back */
+static int gunzip(struct decomp *d, unsigned char *in) {
+    z_stream z;
+    int ret = Z_OK, ended = 0;
+    char *out;
+
+    memset(&z, 0, sizeof(z));
+    if(inflateInit2(&z, 15 + 32) != Z_OK) return -1;
+    if(!(out = slot_get(d))) goto stop;
+    z.next_out = (unsigned char *)out;
+    z.avail_out = DECOMP_SLOT_SIZE;
+
+    for(;;) {
+        // a full slot is handed over before any more input is taken
+        if(!z.avail_out) {
+            slot_put(d, DECOMP_SLOT_SIZE);
+            if(!(out = slot_get(d))) goto stop;
+            z.next_out = (unsigned char *)out;
+            z.avail_out = DECOMP_SLOT_SIZE;
+        } else if(!z.avail_in) {
+            ssize_t n = read_input(d, in);
+
+            if(n <= 0) {
+                ret = (n == 0 && ended) ? 0 : -1;
+                break;
+            }
+            z.next_in = in;
+            z.avail_in = n;
+        }
+
+        if(ended) {
+            if(inflateReset(&z) != Z_OK) {
+                ret = -1;
+                break;
+            }
+            ended = 0;
+        }
+        ret = inflate(&z, Z_NO_FLUSH);
+        if(ret == Z_STREAM_END) ended = 1;
+        else if(ret != Z_OK && ret != Z_BUF_ERROR) {
+            ret = -1;
+            break;
+        }
+    }
+    slot_put(d, DECOMP_SLOT_SIZE - z.avail_out);
+
+stop:
+    inflateEnd(&z);
+    return ret;
+}
+
+#ifdef ACLLH_ZSTD
+static int unzstd(struct decomp *d, unsigned char *in) {
+    ZSTD_DStream *ds = ZSTD_createDStream();
+    ZSTD_inBuffer zin = { in, 0, 0 };
+    ZSTD_outBuffer zout;
+    size_t left = 0;            // 0 between frames
+    int ret = -1;
+
+    if(!ds || ZSTD_isError(ZSTD_initDStream(ds))) goto stop;
+    if(!(zout.dst = slot_get(d))) goto stop;
+    zout.size = DECOMP_SLOT_SIZE;
+    zout.pos = 0;
+
+    for(;;) {
+        if(zout.pos == zout.size) {
+            slot_put(d, zout.pos);
+            if(!(zout.dst = slot_get(d))) goto stop;
+            zout.pos = 0;
+        } else if(zin.pos == zin.size) {
+            ssize_t n = read_input(d, in);
+
+            if(n <= 0) {
+                ret = (n == 0 && !left) ? 0 : -1;
+                break;
+            }
+            zin.size = n;
+            zin.pos = 0;
+        }
+
+        left = ZSTD_decompressStream(ds, &zout, &zin);
+        if(ZSTD_isError(left)) break;
+    }
+    slot_put(d, zout.pos);
+
+stop:
+    ZSTD_freeDStream(ds);
+    return ret;
+}
+#endif
+
+static void *decompress(void *arg) {
+    struct decomp *d = arg;
+    unsigned char *in = malloc(DECOMP_READ_SIZE);
+    struct timespec cpu;
+    int ret = -1;
+
+    if(in) {
+#ifdef ACLLH_ZSTD
+        if(d->kind == DECOMP_ZSTD) ret = unzstd(d, in);
+        else
+#endif
+        ret = gunzip(d, in);
+    }
+    free(in);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+
+    pthread_mutex_lock(&d->lock);
+    d->cpu_ns = cpu.tv_sec * 1000000000ULL + cpu.tv_nsec;
+    d->failed = (ret < 0 && !d->closing);
+    d->done = 1;
+    pthread_cond_signal(&d->filled);
+    pthread_mutex_unlock(&d->lock);
+    return NULL;
+}
+
+/* starts decompressing fd, which is closed by decomp_close() */
+int decomp_open(struct decomp *d, int fd, enum decomp_kind kind) {
+    int i, err;
+
+    memset(d, 0, sizeof(*d));
+    d->fd = fd;
+    d->kind = kind;
+    for(i = 0; i < DECOMP_SLOTS; ++i) {
+        if(!(d->slots[i].data = malloc(DECOMP_SLOT_SIZE))) goto fail;
+    }
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->filled, NULL);
+    pthread_cond_init(&d->drained, NULL);
+    if((errno = pthread_create(&d->thread, NULL, decompress, d))) {
+        pthread_cond_destroy(&d->drained);
+        pthread_cond_destroy(&d->filled);
+        pthread_mutex_destroy(&d->lock);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    err = errno;
+    for(i = 0; i < DECOMP_SLOTS; ++i) free(d->slots[i].data);
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+static ssize_t decomp_read(void *cookie, char *buf, size_t size) {
+    struct decomp *d = cookie;
+    struct decomp_slot *s;
+    size_t n;
+
+    pthread_mutex_lock(&d->lock);
+    while(!d->count && !d->done) pthread_cond_wait(&d->filled, &d->lock);
+    if(!d->count) {
+        pthread_mutex_unlock(&d->lock);
+        return 0;
+    }
+    s = &d->slots[d->head];
+    pthread_mutex_unlock(&d->lock);
+
+    // the decompressor leaves filled slots alone, so the copy needs no lock
+    n = s->len - d->pos < size ? s->len - d->pos : size;
+    memcpy(buf, s->data + d->pos, n);
+    d->pos += n;
+    if(d->pos == s->len) {
+        pthread_mutex_lock(&d->lock);
+        d->head = (d->head + 1) % DECOMP_SLOTS;
+        d->count--;
+        d->pos = 0;
+        pthread_cond_signal(&d->drained);
+        pthread_mutex_unlock(&d->lock);
+    }
+    return n;
+}
+
+/*
+ * The decompressed data as a stream. It keeps stdio's buffer: unbuffered,
+ * glibc would call decomp_read() once per byte, while reads at least as
+ * large as the buffer go straight into the scanner's anyway.
+ */
+FILE *decomp_fopen(struct decomp *d) {
+    cookie_io_functions_t io = { decomp_read, NULL, NULL, NULL };
+
+    return fopencookie(d, "r", io);
+}
+
+/* stops the decompressor if it is still running; -1 if the data was corrupt */
+int decomp_close(struct decomp *d) {
+    int i;
+
+    pthread_mutex_lock(&d->lock);
+    d->closing = 1;
+    pthread_cond_signal(&d->drained);
+    pthread_mutex_unlock(&d->lock);
+    pthread_join(d->thread, NULL);
+
+    for(i = 0; i < DECOMP_SLOTS; ++i) free(d->slots[i].data);
+    pthread_cond_destroy(&d->drained);
+    pthread_cond_destroy(&d->filled);
+    pthread_mutex_destroy(&d->lock);
+    close(d->fd);
+    return d->failed ? -1 : 0;
+}
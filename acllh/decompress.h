@@ -0,0 +1,58 @@
+#ifndef __ACLLH_DECOMPRESS_H
+#define __ACLLH_DECOMPRESS_H
+
+/*
+ *      Compressed inputs for acllh
+ *
+ *      A .gz file (or a .zst file, when built with libzstd) is decompressed
+ *      on a thread of its own into a bounded ring of DECOMP_SLOTS buffers.
+ *      The scanner drains the ring through an ordinary FILE, so
+ *      decompression and lexing overlap while no more than the ring is
+ *      held in memory.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define DECOMP_SLOTS            8
+#define DECOMP_SLOT_SIZE        (256 * 1024)
+#define DECOMP_READ_SIZE        (64 * 1024)
+
+enum decomp_kind {
+    DECOMP_NONE = 0,
+    DECOMP_GZIP,
+    DECOMP_ZSTD,
+};
+
+struct decomp_slot {
+    char *data;
+    size_t len;
+};
+
+struct decomp {
+    int fd;
+    enum decomp_kind kind;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;      // a slot was filled or the decompressor finished
+    pthread_cond_t drained;     // a slot was emptied or the reader went away
+    struct decomp_slot slots[DECOMP_SLOTS];
+    int head;                   // the slot the reader takes next
+    int count;                  // filled slots from head on
+    size_t pos;                 // bytes of the head slot already read
+    int done;
+    int failed;
+    int closing;
+    uint64_t in_bytes;
+    uint64_t out_bytes;
+    uint64_t cpu_ns;            // of the decompressor thread, set when it is done
+};
+
+enum decomp_kind decomp_kind(const char *path);
+const char *decomp_name(enum decomp_kind kind);
+int decomp_open(struct decomp *d, int fd, enum decomp_kind kind);
+FILE *decomp_fopen(struct decomp *d);
+int decomp_close(struct decomp *d);
+
+#endif
@@ -0,0 +1,320 @@
+/*
+ *      Hand-written scanner behind libacllh.h (libacllh-dfa.a)
+ *
+ *      The rules of acllh.l coded as direct branches: a switch on the
+ *      first byte picks the few rules that can start there, and each of
+ *      them is matched by a loop of its own. Flex's choice is kept
+ *      exactly, longest match first and the earlier rule on a tie, so
+ *      the tokens are those of libacllh.a, field for field:
+ *
+ *          "e5", "E+3"     constants: {exp} alone is a {number}
+ *          "1.", ".5"      "1" and ".", and one constant
+ *          "-0x1f"         one constant; only hex numbers take a sign
+ *          "true"          a constant, "sizeof" an operator, when the
+ *                          identifier is no longer than that
+ *          "  #x" at BOL   a macro; '#' anywhere else is invalid
+ *
+ *      The start conditions become inner loops: a comment or string is
+ *      taken whole before it is stored, so a batch only ever ends
+ *      between tokens and resuming needs no more than the position and
+ *      the line. Blanks, '\r' and newlines make no tokens.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "keywords.h"
+#include "libacllh.h"
+#include "span.h"
+
+/* lookahead reads up to this many bytes past the input; they are NULs and never match */
+#define DFA_PAD                 4
+
+#define IS_DIGIT(c)             ((c) >= '0' && (c) <= '9')
+#define IS_HEX(c)               (IS_DIGIT(c) || ((c) >= 'a' && (c) <= 'f') || ((c) >= 'A' && (c) <= 'F'))
+#define IS_WORD(c)              (IS_DIGIT(c) || ((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') || (c) == '_')
+
+const char acllh_scanner[] = "dfa";
+
+struct acllh_lexer {
+    char *buf;                  // the input and DFA_PAD NULs
+    size_t cap;
+    const char *p;              // first byte not yet scanned
+    const char *end;
+    uint32_t line;
+    int done;
+};
+
+static pthread_once_t span_once = PTHREAD_ONCE_INIT;
+
+static void pick_span(void) {
+    span = span_best();
+}
+
+/* [Ee][-+]?[0-9]+ at p, or 0 */
+static inline size_t match_exp(const char *p) {
+    const char *q = p + 1;
+
+    if(*p != 'E' && *p != 'e') return 0;
+    if(*q == '+' || *q == '-') q++;
+    if(!IS_DIGIT(*q)) return 0;
+    while(IS_DIGIT(*q)) q++;
+    return q - p;
+}
+
+/* [0-9]*("."[0-9]+)?{exp}? at p, which starts with a digit or ".[0-9]" */
+static inline size_t match_decimal(const char *p) {
+    const char *q = p;
+
+    while(IS_DIGIT(*q)) q++;
+    if(*q == '.' && IS_DIGIT(q[1])) {
+        q += 2;
+        while(IS_DIGIT(*q)) q++;
+    }
+    return q - p + match_exp(q);
+}
+
+/* 0[xX]{hex}+ at p, or 0 */
+static inline size_t match_hex(const char *p) {
+    const char *q = p + 2;
+
+    if(p[0] != '0' || (p[1] != 'x' && p[1] != 'X') || !IS_HEX(*q)) return 0;
+    while(IS_HEX(*q)) q++;
+    return q - p;
+}
+
+/*
+ * The operator starting at p: its length is that of the longest of
+ * "c", "c=", "cc" and "cc=" that is one, as the flags of c say.
+ */
+#define OP_EQ                   1       // c=
+#define OP_TWICE                2       // cc
+#define OP_TWICE_EQ             4       // cc=
+
+static inline size_t match_operator(const char *p, int forms) {
+    if(p[1] == p[0] && (forms & OP_TWICE)) return (forms & OP_TWICE_EQ) && p[2] == '=' ? 3 : 2;
+    return (forms & OP_EQ) && p[1] == '=' ? 2 : 1;
+}
+
+struct acllh_lexer *acllh_lexer_create(void) {
+    struct acllh_lexer *lx = calloc(1, sizeof(struct acllh_lexer));
+
+    if(!lx) return NULL;
+    pthread_once(&span_once, pick_span);
+    lx->done = 1;
+    return lx;
+}
+
+void acllh_lexer_destroy(struct acllh_lexer *lx) {
+    if(!lx) return;
+    free(lx->buf);
+    free(lx);
+}
+
+int acllh_lexer_reset(struct acllh_lexer *lx, const char *text, size_t len) {
+    lx->done = 1;
+    if(len + DFA_PAD > lx->cap) {
+        char *buf = realloc(lx->buf, len + DFA_PAD);
+
+        if(!buf) return -1;
+        lx->buf = buf;
+        lx->cap = len + DFA_PAD;
+    }
+    if(len) memcpy(lx->buf, text, len);
+    memset(lx->buf + len, 0, DFA_PAD);
+
+    lx->p = lx->buf;
+    lx->end = lx->buf + len;
+    lx->line = 1;
+    lx->done = 0;
+    return 0;
+}
+
+size_t acllh_lexer_next(struct acllh_lexer *lx, struct acllh_tokens *t) {
+    const char *buf = lx->buf, *end = lx->end, *p = lx->p, *q;
+    uint32_t line = lx->line, first;
+    enum tok_kind kind;
+    int id;
+    size_t n;
+
+    t->n = 0;
+    if(lx->done || !t->cap) return 0;
+
+    while(t->n < t->cap) {
+        if(p == end) {
+            lx->done = 1;
+            break;
+        }
+        first = line;
+        id = -1;
+        q = p + 1;
+
+        switch((unsigned char)*p) {
+        case '\n':
+            line++;
+            /* fall through */
+        case '\r':
+            p = q;
+            continue;
+
+        case ' ': case '\t':
+            // {macro} needs the beginning of a line and wins whenever it matches
+            q = p + span->blank(p, end);
+            if((p == buf || p[-1] == '\n') && q < end && *q == '#') goto macro;
+            p = q;
+            continue;
+
+        case '#':
+            if(p != buf && p[-1] != '\n') goto invalid;
+        macro:
+            q += span->line(q, end);
+            kind = TOK_MACRO;
+            break;
+
+        case '/':
+            if(*q == '/') {
+                // <LINECOMMENT>: the token stops before the newline
+                q++;
+                q += span->line(q, end);
+                kind = TOK_COMMENT;
+                break;
+            }
+            if(*q == '*') {
+                // <BLOCKCOMMENT>: up to "*/" or the end of the buffer
+                q++;
+                for(;;) {
+                    q += span->comment(q, end);
+                    if(q == end) break;
+                    if(*q++ == '\n') line++;
+                    else if(q < end && *q == '/') {
+                        q++;
+                        break;
+                    }
+                }
+                kind = TOK_COMMENT;
+                break;
+            }
+            goto operator_eq;
+
+        case '"':
+            // <BLOCKSTRING>: "\\". skips the escaped byte unless it is a newline
+            for(;;) {
+                q += span->string(q, end);
+                if(q == end) break;
+                if(*q == '"') {
+                    q++;
+                    break;
+                }
+                if(*q == '\n') line++;
+                else if(q + 1 < end && q[1] != '\n') q++;
+                q++;
+            }
+            kind = TOK_CONSTANT;
+            break;
+
+        case '\'':
+            // {charac}: '\x' is longer than '\', so it is tried first
+            if(p[1] == '\\' && p[2] != '\n' && p[3] == '\'') q = p + 4;
+            else if(p[1] != '\n' && p[2] == '\'') q = p + 3;
+            else goto invalid;
+            kind = TOK_CONSTANT;
+            break;
+
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            n = match_hex(p);
+            q = p + (n ? n : match_decimal(p));
+            kind = TOK_CONSTANT;
+            break;
+
+        case '.':
+            if(p[1] == '.' && p[2] == '.') {
+                q = p + 3;
+                kind = TOK_EXTRA;
+            } else if(IS_DIGIT(p[1])) {
+                q = p + match_decimal(p);
+                kind = TOK_CONSTANT;
+            } else {
+                kind = TOK_OPERATOR;
+                id = get_operator_id(p, 1);
+            }
+            break;
+
+        case '+': case '-':
+            if((n = match_hex(q))) {
+                q += n;
+                kind = TOK_CONSTANT;
+                break;
+            }
+            q = p + match_operator(p, OP_EQ | OP_TWICE);
+            goto operator;
+
+        case '<': case '>':
+            q = p + match_operator(p, OP_EQ | OP_TWICE | OP_TWICE_EQ);
+            goto operator;
+
+        case '&': case '|':
+            q = p + match_operator(p, OP_EQ | OP_TWICE);
+            goto operator;
+
+        case '=':
+            q = p + match_operator(p, OP_TWICE);
+            goto operator;
+
+        case '!': case '%': case '^': case '*':
+        operator_eq:
+            q = p + match_operator(p, OP_EQ);
+            /* fall through */
+        case '~': case '(': case ')': case '?': case ':':
+        operator:
+            kind = TOK_OPERATOR;
+            id = get_operator_id(p, q - p);
+            break;
+
+        case '{': case '}': case '[': case ']': case ';': case ',':
+            kind = TOK_DELIMITER;
+            break;
+
+        case '\\':
+            kind = TOK_EXTRA;
+            break;
+
+        case 'A' ... 'Z': case 'a' ... 'z': case '_':
+            while(IS_WORD(*q)) q++;
+            n = q - p;
+            // {constant} and {operator} come before {identifier} and win the ties
+            if((n == 4 && !memcmp(p, "true", 4)) || (n == 5 && !memcmp(p, "false", 5))) {
+                kind = TOK_CONSTANT;
+            } else if(match_exp(p) >= n) {
+                q = p + match_exp(p);
+                kind = TOK_CONSTANT;
+            } else if(n == 6 && !memcmp(p, "sizeof", 6)) {
+                kind = TOK_OPERATOR;
+                id = get_operator_id(p, 6);
+            } else if((id = get_reserved_word_id(p, n)) >= 0) {
+                kind = TOK_RESERVED_WORD;
+            } else {
+                kind = TOK_IDENTIFIER;
+            }
+            break;
+
+        default:
+        invalid:
+            q = p + 1;
+            kind = TOK_INVALID_SYMBOL;
+            break;
+        }
+
+        n = t->n++;
+        t->kinds[n] = kind;
+        if(t->ids) t->ids[n] = id >= 0 ? id : TOK_NO_ID;
+        t->offsets[n] = p - buf;
+        t->lengths[n] = q - p;
+        t->lines[n] = first;
+        p = q;
+    }
+
+    lx->p = p;
+    lx->line = line;
+    return t->n;
+}
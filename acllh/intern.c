@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+
+static void *intern_alloc(size_t size) {
+    void *m = calloc(1, size ? size : 1);
+    if(!m) {
+        perror("acllh");
+        exit(1);
+    }
+    return m;
+}
+
+/* FNV-1a; identifiers are short, so a byte loop is as fast as anything */
+static inline uint64_t intern_hash(const char *s, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for(i = 0; i < len; ++i) h = (h ^ (unsigned char)s[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+static const char *arena_copy(struct intern_table *t, const char *s, size_t len) {
+    struct intern_chunk *c = t->arena;
+    char *p;
+
+    if(!c || c->size - c->used < len) {
+        size_t size = len > INTERN_ARENA_CHUNK ? len : INTERN_ARENA_CHUNK;
+
+        c = intern_alloc(sizeof(struct intern_chunk) + size);
+        c->size = size;
+        c->next = t->arena;
+        t->arena = c;
+    }
+    p = c->data + c->used;
+    memcpy(p, s, len);
+    c->used += len;
+    return p;
+}
+
+struct intern_table *intern_create(void) {
+    struct intern_table *t = intern_alloc(sizeof(struct intern_table));
+
+    t->cap = INTERN_MIN_SLOTS;
+    t->slots = intern_alloc(t->cap * sizeof(struct intern_entry));
+    return t;
+}
+
+void intern_destroy(struct intern_table *t) {
+    struct intern_chunk *c, *next;
+
+    if(!t) return;
+    for(c = t->arena; c; c = next) {
+        next = c->next;
+        free(c);
+    }
+    free(t->slots);
+    free(t);
+}
+
+/* empty the table but keep its slots and newest chunk for the next file */
+void intern_clear(struct intern_table *t) {
+    struct intern_chunk *c, *next;
+
+    if(!t->used) return;
+    memset(t->slots, 0, t->cap * sizeof(struct intern_entry));
+    t->used = 0;
+    if(t->arena) {
+        for(c = t->arena->next; c; c = next) {
+            next = c->next;
+            free(c);
+        }
+        t->arena->next = NULL;
+        t->arena->used = 0;
+    }
+}
+
+static void grow(struct intern_table *t) {
+    struct intern_entry *old = t->slots;
+    size_t old_cap = t->cap, i;
+
+    t->cap *= 2;
+    t->slots = intern_alloc(t->cap * sizeof(struct intern_entry));
+    for(i = 0; i < old_cap; ++i) {
+        size_t j;
+
+        if(!old[i].name) continue;
+        for(j = old[i].hash & (t->cap - 1); t->slots[j].name; j = (j + 1) & (t->cap - 1));
+        t->slots[j] = old[i];
+    }
+    free(old);
+}
+
+static struct intern_entry *lookup(struct intern_table *t, const char *name, size_t len,
+                                   uint64_t hash) {
+    struct intern_entry *e;
+    size_t i;
+
+    for(i = hash & (t->cap - 1); (e = &t->slots[i])->name; i = (i + 1) & (t->cap - 1)) {
+        if(e->hash == hash && e->len == len && !memcmp(e->name, name, len)) return e;
+    }
+
+    // keep the load under 3/4 so probe runs stay short
+    if((t->used + 1) * 4 > t->cap * 3) {
+        grow(t);
+        return lookup(t, name, len, hash);
+    }
+    e->hash = hash;
+    e->name = arena_copy(t, name, len);
+    e->len = len;
+    e->id = t->used++;
+    return e;
+}
+
+void intern_add(struct intern_table *t, const char *name, size_t len) {
+    lookup(t, name, len, intern_hash(name, len))->count++;
+}
+
+size_t intern_id(struct intern_table *t, const char *name, size_t len) {
+    return lookup(t, name, len, intern_hash(name, len))->id;
+}
+
+void intern_fold_file(struct intern_table *to, const struct intern_table *file) {
+    size_t i;
+
+    for(i = 0; i < file->cap; ++i) {
+        const struct intern_entry *f = &file->slots[i];
+        struct intern_entry *e;
+
+        if(!f->name) continue;
+        e = lookup(to, f->name, f->len, f->hash);
+        e->count += f->count;
+        e->files++;
+        if(f->count > e->peak) e->peak = f->count;
+    }
+}
+
+void intern_merge(struct intern_table *to, const struct intern_table *from) {
+    size_t i;
+
+    for(i = 0; i < from->cap; ++i) {
+        const struct intern_entry *f = &from->slots[i];
+        struct intern_entry *e;
+
+        if(!f->name) continue;
+        e = lookup(to, f->name, f->len, f->hash);
+        e->count += f->count;
+        e->files += f->files;
+        if(f->peak > e->peak) e->peak = f->peak;
+    }
+}
+
+static int cmp_frequency(const void *a, const void *b) {
+    const struct intern_entry *x = *(const struct intern_entry **)a;
+    const struct intern_entry *y = *(const struct intern_entry **)b;
+    size_t n = x->len < y->len ? x->len : y->len;
+    int c;
+
+    if(x->count != y->count) return x->count < y->count ? 1 : -1;
+    c = memcmp(x->name, y->name, n);
+    return c ? c : (x->len > y->len) - (x->len < y->len);
+}
+
+size_t intern_top(const struct intern_table *t, const struct intern_entry **top, size_t n) {
+    const struct intern_entry **all = intern_alloc(t->used * sizeof(struct intern_entry *));
+    size_t i, k = 0;
+
+    for(i = 0; i < t->cap; ++i) {
+        if(t->slots[i].name) all[k++] = &t->slots[i];
+    }
+    qsort(all, k, sizeof(struct intern_entry *), cmp_frequency);
+    if(n > k) n = k;
+    memcpy(top, all, n * sizeof(struct intern_entry *));
+    free(all);
+    return n;
+}
+
+/* blob layout, per entry: long count, uint32_t len, len bytes of name */
+char *intern_pack(const struct intern_table *t, size_t *len) {
+    size_t size = 0, i;
+    char *blob, *p;
+
+    for(i = 0; i < t->cap; ++i) {
+        if(t->slots[i].name) size += sizeof(long) + sizeof(uint32_t) + t->slots[i].len;
+    }
+    p = blob = intern_alloc(size);
+    for(i = 0; i < t->cap; ++i) {
+        const struct intern_entry *e = &t->slots[i];
+        uint32_t n = e->len;
+
+        if(!e->name) continue;
+        memcpy(p, &e->count, sizeof(long));
+        memcpy(p + sizeof(long), &n, sizeof(n));
+        memcpy(p + sizeof(long) + sizeof(n), e->name, n);
+        p += sizeof(long) + sizeof(n) + n;
+    }
+    *len = size;
+    return blob;
+}
+
+int intern_unpack(struct intern_table *t, const char *blob, size_t len) {
+    const char *p = blob, *end = blob + len;
+
+    while(p < end) {
+        long count;
+        uint32_t n;
+
+        if((size_t)(end - p) < sizeof(long) + sizeof(n)) return -1;
+        memcpy(&count, p, sizeof(long));
+        memcpy(&n, p + sizeof(long), sizeof(n));
+        p += sizeof(long) + sizeof(n);
+        if((size_t)(end - p) < n) return -1;
+        lookup(t, p, n, intern_hash(p, n))->count += count;
+        p += n;
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef __ACLLH_INTERN_H
+#define __ACLLH_INTERN_H
+
+/*
+ *      Identifier interning table
+ *
+ *      Open addressing with linear probing over a power-of-two slot array.
+ *      Each slot keeps the full hash, so probes compare names only when
+ *      the hashes match. Names are copied once into an arena of large
+ *      chunks, so a table is freed (or reset) in a handful of calls
+ *      however many identifiers it holds.
+ *
+ *      A scanner interns into a per-file table that only counts. Folding
+ *      it into a run table adds the counts, bumps the number of files
+ *      the name occurs in and keeps the peak count in one file. Merging
+ *      two run tables (one per worker) adds all three.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define INTERN_MIN_SLOTS        1024
+#define INTERN_ARENA_CHUNK      (64 * 1024)
+
+struct intern_entry {
+    uint64_t hash;
+    const char *name;           // NULL for an empty slot
+    size_t len;
+    size_t id;                  // order of insertion, from 0
+    long count;                 // occurrences
+    long files;                 // files with at least one occurrence
+    long peak;                  // most occurrences in one file
+};
+
+struct intern_chunk {
+    struct intern_chunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+struct intern_table {
+    struct intern_entry *slots;
+    size_t cap;                 // power of two
+    size_t used;
+    struct intern_chunk *arena; // newest chunk first
+};
+
+struct intern_table *intern_create(void);
+void intern_destroy(struct intern_table *t);
+void intern_clear(struct intern_table *t);
+void intern_add(struct intern_table *t, const char *name, size_t len);
+size_t intern_id(struct intern_table *t, const char *name, size_t len);
+void intern_fold_file(struct intern_table *to, const struct intern_table *file);
+void intern_merge(struct intern_table *to, const struct intern_table *from);
+
+/* the n most frequent entries, most frequent first; returns how many */
+size_t intern_top(const struct intern_table *t, const struct intern_entry **top, size_t n);
+
+/* per-file counts as a flat blob, for the cache; unpacking adds to t */
+char *intern_pack(const struct intern_table *t, size_t *len);
+int intern_unpack(struct intern_table *t, const char *blob, size_t len);
+
+#endif
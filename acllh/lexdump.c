@@ -0,0 +1,74 @@
+/*
+ *      Token dump through libacllh.h
+ *
+ *      Prints every token of every file as "line kind id offset length",
+ *      fetched in batches of -n tokens (default 4096; 1 makes the lexer
+ *      stop and resume after each token). Linked once against each
+ *      scanner, the dumps of the two must be identical: see diff-dfa.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libacllh.h"
+
+static char *load(const char *path, size_t *len) {
+    size_t cap = 1 << 16, n = 0, r;
+    char *buf = malloc(cap);
+    FILE *f = fopen(path, "rb");
+
+    if(!f) {
+        perror(path);
+        exit(1);
+    }
+    while((r = fread(buf + n, 1, cap - n, f)) > 0) {
+        n += r;
+        if(n == cap) buf = realloc(buf, cap *= 2);
+    }
+    fclose(f);
+    *len = n;
+    return buf;
+}
+
+int main(int argc, char **argv) {
+    struct acllh_lexer *lx = acllh_lexer_create();
+    struct acllh_tokens t;
+    size_t batch = 4096, len, i;
+    int first = 1;
+    char *buf;
+
+    if(argc > 2 && !strcmp(argv[1], "-n")) {
+        batch = strtoul(argv[2], NULL, 10);
+        first = 3;
+    }
+    if(first >= argc || !batch || !lx) {
+        fprintf(stderr, "usage: %s [-n batch] file ...\n", argv[0]);
+        return 1;
+    }
+
+    t.kinds = malloc(batch * sizeof(*t.kinds));
+    t.ids = malloc(batch * sizeof(*t.ids));
+    t.offsets = malloc(batch * sizeof(*t.offsets));
+    t.lengths = malloc(batch * sizeof(*t.lengths));
+    t.lines = malloc(batch * sizeof(*t.lines));
+    t.cap = batch;
+
+    for(; first < argc; ++first) {
+        buf = load(argv[first], &len);
+        if(acllh_lexer_reset(lx, buf, len) < 0) {
+            perror(argv[first]);
+            return 1;
+        }
+        printf("%s\n", argv[first]);
+        while(acllh_lexer_next(lx, &t)) {
+            for(i = 0; i < t.n; ++i) {
+                printf("%u %u %u %lu %u\n", t.lines[i], t.kinds[i], t.ids[i],
+                       (unsigned long)t.offsets[i], t.lengths[i]);
+            }
+        }
+        free(buf);
+    }
+
+    acllh_lexer_destroy(lx);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef __LIBACLLH_H
+#define __LIBACLLH_H
+
+/*
+ *      acllh as a library (libacllh.a)
+ *
+ *      The scanner of acllh.l built with ACLLH_LIBRARY: no highlighting,
+ *      no output.txt, no stdio. A lexer takes one buffer at a time and
+ *      fills batches the caller provides, one array per field, without
+ *      allocating anything per token:
+ *
+ *          struct acllh_lexer *lx = acllh_lexer_create();
+ *
+ *          acllh_lexer_reset(lx, text, len);
+ *          while(acllh_lexer_next(lx, &batch))
+ *              for(i = 0; i < batch.n; ++i) ... batch.kinds[i] ...
+ *
+ *      The tokens are those of output.tok, with the same kinds and ids,
+ *      plus block comments and string literals, which come back whole as
+ *      TOK_COMMENT and TOK_CONSTANT. Only blanks and newlines are left out.
+ *      Lexers share nothing, so every thread can own one.
+ *
+ *      libacllh-dfa.a implements the same interface with the hand-written
+ *      scanner of dfa.c; a program picks one of the two when it links.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tokstream.h"
+
+struct acllh_tokens {
+    uint8_t *kinds;             // enum tok_kind
+    uint16_t *ids;              // keyword or operator id, TOK_NO_ID otherwise; NULL if not wanted
+    uint64_t *offsets;          // of the first byte in the buffer
+    uint32_t *lengths;
+    uint32_t *lines;            // of the first byte, from 1
+    size_t cap;                 // entries in each array, at least 1
+    size_t n;                   // entries acllh_lexer_next() filled
+};
+
+struct acllh_lexer;
+
+/* "flex" or "dfa", whichever scanner the program was linked with */
+extern const char acllh_scanner[];
+
+/* NULL when out of memory */
+struct acllh_lexer *acllh_lexer_create(void);
+void acllh_lexer_destroy(struct acllh_lexer *lx);
+
+/* start on len bytes at text, which are copied; -1 when out of memory */
+int acllh_lexer_reset(struct acllh_lexer *lx, const char *text, size_t len);
+
+/* the next batch of up to t->cap tokens, 0 once the buffer is done */
+size_t acllh_lexer_next(struct acllh_lexer *lx, struct acllh_tokens *t);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ *      mkhash - generate collision-free lookup tables for acllh keywords
+ *
+ *      Reads the reserved word and operator lists from keywords.def and
+ *      searches for a multiplier that maps every entry of a list to its
+ *      own slot. The result is printed as a C header (keywords.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define HASH_MULT_TRIES         100000
+
+static const char *reserved_words[] = {
+#define RESERVED_WORD(s) s,
+#include "keywords.def"
+#undef RESERVED_WORD
+};
+
+static const char *operators[] = {
+#define OPERATOR(s) s,
+#include "keywords.def"
+#undef OPERATOR
+};
+
+#define COUNT(a)                ((int)(sizeof(a) / sizeof((a)[0])))
+
+// must match keyword_hash() in the generated header
+static unsigned int keyword_hash(const char *s, int len, unsigned int mult) {
+    unsigned int h = 0;
+
+    while(len--) h = h * mult + (unsigned char)*s++;
+
+    return h ^ (h >> 16);
+}
+
+static int try_mult(const char **words, int n, unsigned int mult, int size, int *slots) {
+    int i;
+
+    for(i = 0; i < size; ++i) slots[i] = -1;
+
+    for(i = 0; i < n; ++i) {
+        unsigned int h = keyword_hash(words[i], strlen(words[i]), mult) & (size - 1);
+
+        if(slots[h] >= 0) return 0;
+        slots[h] = i;
+    }
+
+    return 1;
+}
+
+static const char *upper(const char *name) {
+    static char buf[64];
+    int i;
+
+    for(i = 0; name[i] && i < (int)sizeof(buf) - 1; ++i) buf[i] = toupper((unsigned char)name[i]);
+    buf[i] = '\0';
+
+    return buf;
+}
+
+static void emit_table(const char *name, const char **words, int n) {
+    int size, i, *slots;
+    unsigned int mult = 0, seed = 2166136261u;
+
+    for(size = 1; size < 2 * n; size <<= 1);
+
+    for(;;) {
+        slots = malloc(size * sizeof(int));
+        if(!slots) {
+            fprintf(stderr, "mkhash: out of space\n");
+            exit(1);
+        }
+
+        for(i = 0; i < HASH_MULT_TRIES; ++i) {
+            seed = seed * 1664525u + 1013904223u;
+            mult = seed | 1;
+            if(try_mult(words, n, mult, size, slots)) break;
+        }
+        if(i < HASH_MULT_TRIES) break;
+
+        free(slots);
+        size <<= 1;
+    }
+
+    printf("#define %s_HASH_MULT%*s0x%08xu\n", upper(name), (int)(14 - strlen(name)), "", mult);
+    printf("#define %s_HASH_SIZE%*s%d\n\n", upper(name), (int)(14 - strlen(name)), "", size);
+    printf("static const struct keyword_slot %s_slots[%d] = {\n", name, size);
+    for(i = 0; i < size; ++i) {
+        if(slots[i] < 0) {
+            printf("    { \"\", 0, -1 },\n");
+        } else {
+            printf("    { \"%s\", %d, %d },\n",
+                   words[slots[i]], (int)strlen(words[slots[i]]), slots[i]);
+        }
+    }
+    printf("};\n\n");
+
+    free(slots);
+}
+
+static void emit_lookup(const char *fn, const char *name) {
+    printf("static inline int %s(const char *s, int len) {\n", fn);
+    printf("    const struct keyword_slot *k = &%s_slots[\n", name);
+    printf("        keyword_hash(s, len, %s_HASH_MULT)", upper(name));
+    printf(" & (%s_HASH_SIZE - 1)];\n", upper(name));
+    printf("    return (k->len == len && !memcmp(k->name, s, len)) ? k->id : -1;\n");
+    printf("}\n\n");
+}
+
+int main(void) {
+    printf("/* generated by mkhash from keywords.def, do not edit */\n\n");
+    printf("#ifndef __ACLLH_KEYWORDS_H\n#define __ACLLH_KEYWORDS_H\n\n");
+    printf("#include <string.h>\n\n");
+    printf("#define RESERVED_WORDS_NUM      %d\n", COUNT(reserved_words));
+    printf("#define OPERATORS_NUM           %d\n\n", COUNT(operators));
+    printf("struct keyword_slot {\n    const char *name;\n    int len;\n    int id;\n};\n\n");
+    printf("static inline unsigned int keyword_hash(const char *s, int len, unsigned int mult) {\n");
+    printf("    unsigned int h = 0;\n\n");
+    printf("    while(len--) h = h * mult + (unsigned char)*s++;\n\n");
+    printf("    return h ^ (h >> 16);\n}\n\n");
+
+    emit_table("reserved_word", reserved_words, COUNT(reserved_words));
+    emit_table("operator", operators, COUNT(operators));
+    emit_lookup("get_reserved_word_id", "reserved_word");
+    emit_lookup("get_operator_id", "operator");
+
+    printf("#endif\n");
+
+    return 0;
+}
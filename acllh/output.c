@@ -0,0 +1,269 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "acllh.h"
+
+const struct out_style out_ansi = {
+    "ansi",
+    {
+        [OUT_MACRO]             = OUT_LIT(MACRO_COLOR),
+        [OUT_COMMENT]           = OUT_LIT(COMMENT_COLOR),
+        [OUT_CONSTANT]          = OUT_LIT(CONSTANT_COLOR),
+        [OUT_OPERATOR]          = OUT_LIT(OPERATOR_COLOR),
+        [OUT_RESERVED_WORD]     = OUT_LIT(RESERVED_WORD_COLOR),
+        [OUT_IDENTIFIER]        = OUT_LIT(IDENTIFIER_COLOR),
+        [OUT_INVALID_SYMBOL]    = OUT_LIT(INVALID_SYMBOL_COLOR),
+        [OUT_LINE_NO]           = OUT_LIT(LINE_NO_COLOR),
+    },
+    OUT_LIT(NONE),
+    OUT_LIT(""),
+    0,
+    OUT_LIT(""),
+    OUT_LIT(""),
+    OUT_LIT("------     "),
+    OUT_LIT("     ------\n\n"),
+    OUT_LIT("\n\n"),
+};
+
+const struct out_style out_html = {
+    "html",
+    {
+        [OUT_MACRO]             = OUT_LIT("<span class=\"macro\">"),
+        [OUT_COMMENT]           = OUT_LIT("<span class=\"comment\">"),
+        [OUT_CONSTANT]          = OUT_LIT("<span class=\"constant\">"),
+        [OUT_OPERATOR]          = OUT_LIT("<span class=\"operator\">"),
+        [OUT_RESERVED_WORD]     = OUT_LIT("<span class=\"reserved\">"),
+        [OUT_IDENTIFIER]        = OUT_LIT("<span class=\"identifier\">"),
+        [OUT_INVALID_SYMBOL]    = OUT_LIT("<span class=\"invalid\">"),
+        [OUT_LINE_NO]           = OUT_LIT("<span class=\"lineno\">"),
+    },
+    OUT_LIT(""),
+    OUT_LIT("</span>"),
+    1,
+    OUT_LIT("<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n<title>acllh</title>\n"
+            "<style>\n"
+            "pre { font-family: monospace; }\n"
+            ".macro { color: #af8700; }\n"
+            ".comment { color: #008700; }\n"
+            ".constant { color: #870087; }\n"
+            ".operator { color: #808080; }\n"
+            ".reserved { color: #0000d7; }\n"
+            ".identifier { color: #00afaf; font-weight: bold; }\n"
+            ".invalid { color: #d70000; }\n"
+            ".lineno { color: #ff0000; font-weight: bold; }\n"
+            "</style>\n</head>\n<body>\n"),
+    OUT_LIT("</body>\n</html>\n"),
+    OUT_LIT("<h2>"),
+    OUT_LIT("</h2>\n<pre>"),
+    OUT_LIT("</pre>\n"),
+};
+
+void out_init(struct outbuf *o, int fd, enum out_mode mode) {
+    struct stat st;
+
+    o->fd = fd;
+    o->mem = NULL;
+    o->mem_len = o->mem_cap = 0;
+    o->niov = 0;
+    o->stage_used = 0;
+    o->style = &out_ansi;
+    o->color = OUT_NONE;
+
+    if(mode == OUT_MODE_AUTO) {
+        mode = (isatty(fd) || (!fstat(fd, &st) && S_ISFIFO(st.st_mode)))
+            ? OUT_MODE_LINE : OUT_MODE_THROUGHPUT;
+    }
+    o->linebuf = (mode == OUT_MODE_LINE);
+}
+
+void out_init_mem(struct outbuf *o) {
+    out_init(o, -1, OUT_MODE_THROUGHPUT);
+}
+
+static void out_writev(int fd, struct iovec *iov, int niov) {
+    while(niov > 0) {
+        ssize_t n = writev(fd, iov, niov);
+
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return;
+        }
+
+        while(niov > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            niov--;
+        }
+        if(niov > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+static void out_append(struct outbuf *o, const char *s, size_t n) {
+    if(o->mem_len + n > o->mem_cap) {
+        size_t cap = o->mem_cap ? o->mem_cap : OUT_STAGE_SIZE;
+        char *mem;
+
+        while(cap < o->mem_len + n) cap *= 2;
+        mem = realloc(o->mem, cap);
+        if(!mem) {
+            perror("acllh");
+            exit(1);
+        }
+        o->mem = mem;
+        o->mem_cap = cap;
+    }
+    memcpy(o->mem + o->mem_len, s, n);
+    o->mem_len += n;
+}
+
+void out_write(int fd, const char *s, size_t n) {
+    struct iovec iov = { (void *)s, n };
+    out_writev(fd, &iov, 1);
+}
+
+void out_flush(struct outbuf *o) {
+    int i;
+
+    if(o->fd < 0) {
+        for(i = 0; i < o->niov; ++i) out_append(o, o->iov[i].iov_base, o->iov[i].iov_len);
+    } else {
+        out_writev(o->fd, o->iov, o->niov);
+    }
+    o->niov = 0;
+    o->stage_used = 0;
+}
+
+char *out_take(struct outbuf *o, size_t *len) {
+    char *mem;
+
+    out_flush(o);
+    mem = o->mem;
+    *len = o->mem_len;
+    o->mem = NULL;
+    o->mem_len = o->mem_cap = 0;
+
+    return mem;
+}
+
+void out_ref(struct outbuf *o, const char *s, size_t n) {
+    if(n < OUT_REF_MIN) {
+        out_copy(o, s, n);
+        return;
+    }
+
+    if(o->niov == OUT_IOV_MAX) out_flush(o);
+    o->iov[o->niov].iov_base = (void *)s;
+    o->iov[o->niov].iov_len = n;
+    o->niov++;
+}
+
+void out_copy(struct outbuf *o, const char *s, size_t n) {
+    char *dst;
+    struct iovec *last;
+
+    if(o->stage_used + n > OUT_STAGE_SIZE || o->niov == OUT_IOV_MAX) {
+        out_flush(o);
+        if(n > OUT_STAGE_SIZE) {
+            if(o->fd < 0) out_append(o, s, n);
+            else out_write(o->fd, s, n);
+            return;
+        }
+    }
+
+    dst = o->stage + o->stage_used;
+    memcpy(dst, s, n);
+    o->stage_used += n;
+
+    last = o->niov ? &o->iov[o->niov - 1] : NULL;
+    if(last && (char *)last->iov_base + last->iov_len == dst) {
+        last->iov_len += n;
+    } else {
+        o->iov[o->niov].iov_base = dst;
+        o->iov[o->niov].iov_len = n;
+        o->niov++;
+    }
+}
+
+void out_char(struct outbuf *o, char c) {
+    out_copy(o, &c, 1);
+}
+
+void out_num(struct outbuf *o, int value, int width) {
+    char buf[16];
+    char *p = buf + sizeof(buf);
+    unsigned int u = value < 0 ? -(unsigned int)value : (unsigned int)value;
+
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while(u);
+    if(value < 0) *--p = '-';
+
+    while(buf + sizeof(buf) - p < width) *--p = ' ';
+
+    out_copy(o, p, buf + sizeof(buf) - p);
+}
+
+void out_newline(struct outbuf *o) {
+    out_char(o, '\n');
+    if(o->linebuf) out_flush(o);
+}
+
+#define OUT_LIT_COPY(o, lit)    out_copy((o), (lit).s, (lit).n)
+
+void out_transition(struct outbuf *o, enum out_color color) {
+    const struct out_style *st = o->style;
+
+    if(o->color != OUT_NONE) OUT_LIT_COPY(o, st->close);
+    if(color != OUT_NONE) OUT_LIT_COPY(o, st->open[color]);
+    else OUT_LIT_COPY(o, st->reset);
+    o->color = color;
+}
+
+static void out_raw(struct outbuf *o, const char *s, size_t n, int stable) {
+    if(stable) out_ref(o, s, n);
+    else out_copy(o, s, n);
+}
+
+static void out_escaped(struct outbuf *o, const char *s, size_t n, int stable) {
+    const char *end = s + n, *p;
+
+    for(p = s; p < end; ++p) {
+        const char *entity;
+        size_t len;
+
+        switch(*p) {
+            case '<': entity = "&lt;"; len = 4; break;
+            case '>': entity = "&gt;"; len = 4; break;
+            case '&': entity = "&amp;"; len = 5; break;
+            default: continue;
+        }
+        if(p > s) out_raw(o, s, p - s, stable);
+        out_copy(o, entity, len);
+        s = p + 1;
+    }
+    if(s < end) out_raw(o, s, end - s, stable);
+}
+
+/* stable text outlives the buffer's next flush and may be referenced in place */
+void out_text(struct outbuf *o, const char *s, size_t n, int stable) {
+    if(o->style->escape_html) out_escaped(o, s, n, stable);
+    else out_raw(o, s, n, stable);
+}
+
+void out_file_begin(struct outbuf *o, const char *path) {
+    OUT_LIT_COPY(o, o->style->file_begin);
+    out_text(o, path, strlen(path), 0);
+    OUT_LIT_COPY(o, o->style->file_mid);
+}
+
+void out_file_end(struct outbuf *o) {
+    out_color(o, OUT_NONE);
+    OUT_LIT_COPY(o, o->style->file_end);
+}
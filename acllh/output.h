@@ -0,0 +1,105 @@
+#ifndef __ACLLH_OUTPUT_H
+#define __ACLLH_OUTPUT_H
+
+/*
+ *      Buffered output pipeline for acllh
+ *
+ *      Escape sequences and token text are collected into an iovec list
+ *      and handed to the kernel with one writev() per chunk. Stable memory
+ *      (string literals) is referenced in place, transient text (yytext)
+ *      is copied into a staging area first.
+ *
+ *      A buffer opened with out_init_mem() collects into memory instead,
+ *      so a worker can render a file and hand the bytes over in one piece.
+ *
+ *      Highlighted text goes through out_color()/out_text(). The buffer
+ *      remembers the color in effect and writes a transition only when
+ *      it changes, in the markup of its style (ANSI escapes or HTML).
+ */
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define OUT_IOV_MAX             1024
+#define OUT_STAGE_SIZE          (64 * 1024)
+#define OUT_REF_MIN             64      // shorter slices are cheaper to copy
+
+enum out_color {
+    OUT_NONE = 0,
+    OUT_MACRO,
+    OUT_COMMENT,
+    OUT_CONSTANT,
+    OUT_OPERATOR,
+    OUT_RESERVED_WORD,
+    OUT_IDENTIFIER,
+    OUT_INVALID_SYMBOL,
+    OUT_LINE_NO,
+    OUT_COLORS
+};
+
+struct out_lit {
+    const char *s;
+    size_t n;
+};
+
+#define OUT_LIT(lit)            { (lit), sizeof(lit) - 1 }
+
+struct out_style {
+    const char *name;
+    struct out_lit open[OUT_COLORS];    // starts a color
+    struct out_lit reset;               // back to no color, if closing is not enough
+    struct out_lit close;               // ends a color, if opening the next is not enough
+    int escape_html;
+    struct out_lit doc_begin;
+    struct out_lit doc_end;
+    struct out_lit file_begin;          // file_begin path file_mid
+    struct out_lit file_mid;
+    struct out_lit file_end;
+};
+
+extern const struct out_style out_ansi;
+extern const struct out_style out_html;
+
+enum out_mode {
+    OUT_MODE_AUTO = 0,          // line-buffered on ttys and pipes, throughput on files
+    OUT_MODE_LINE,              // flush after every newline
+    OUT_MODE_THROUGHPUT,        // flush only when the iovec list or stage is full
+};
+
+struct outbuf {
+    int fd;                     // -1 for a memory sink
+    char *mem;
+    size_t mem_len;
+    size_t mem_cap;
+    int linebuf;
+    const struct out_style *style;
+    enum out_color color;       // in effect at the end of the buffer
+    int niov;
+    size_t stage_used;
+    struct iovec iov[OUT_IOV_MAX];
+    char stage[OUT_STAGE_SIZE];
+};
+
+void out_init(struct outbuf *o, int fd, enum out_mode mode);
+void out_init_mem(struct outbuf *o);
+char *out_take(struct outbuf *o, size_t *len);
+void out_write(int fd, const char *s, size_t n);
+void out_ref(struct outbuf *o, const char *s, size_t n);
+void out_copy(struct outbuf *o, const char *s, size_t n);
+void out_char(struct outbuf *o, char c);
+void out_num(struct outbuf *o, int value, int width);
+void out_newline(struct outbuf *o);
+void out_flush(struct outbuf *o);
+
+void out_text(struct outbuf *o, const char *s, size_t n, int stable);
+void out_transition(struct outbuf *o, enum out_color color);
+void out_file_begin(struct outbuf *o, const char *path);
+void out_file_end(struct outbuf *o);
+
+static inline void out_color(struct outbuf *o, enum out_color color) {
+    if(o->color != color) out_transition(o, color);
+}
+
+#define OUT_STR(o, lit)         out_ref((o), (lit), sizeof(lit) - 1)
+
+#endif
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "pool.h"
+
+struct pool_worker {
+    struct pool *p;
+    int id;
+};
+
+static int pool_pop(struct pool_deque *d) {
+    int item = -1;
+
+    pthread_mutex_lock(&d->lock);
+    if(d->head < d->tail) item = d->items[d->head++];
+    pthread_mutex_unlock(&d->lock);
+
+    return item;
+}
+
+static int pool_steal(struct pool_deque *d) {
+    int item = -1;
+
+    pthread_mutex_lock(&d->lock);
+    if(d->head < d->tail) item = d->items[--d->tail];
+    pthread_mutex_unlock(&d->lock);
+
+    return item;
+}
+
+static void *pool_main(void *arg) {
+    struct pool_worker *w = arg;
+    struct pool *p = w->p;
+    int item, i;
+
+    for(;;) {
+        item = pool_pop(&p->deques[w->id]);
+
+        // nothing is ever pushed back, so one empty sweep means we are done
+        for(i = 1; item < 0 && i < p->nworkers; ++i) {
+            item = pool_steal(&p->deques[(w->id + i) % p->nworkers]);
+        }
+        if(item < 0) break;
+
+        p->fn(p->arg, w->id, item);
+    }
+
+    free(w);
+    return NULL;
+}
+
+static void *pool_malloc(size_t size) {
+    void *m = malloc(size);
+    if(!m) {
+        perror("pool");
+        exit(1);
+    }
+    return m;
+}
+
+struct pool *pool_start(int nworkers, int nitems, pool_fn fn, void *arg) {
+    struct pool *p = pool_malloc(sizeof(struct pool));
+    int i, w, next;
+
+    p->nworkers = nworkers;
+    p->fn = fn;
+    p->arg = arg;
+    p->threads = pool_malloc(nworkers * sizeof(pthread_t));
+    p->deques = pool_malloc(nworkers * sizeof(struct pool_deque));
+    p->items = pool_malloc((nitems ? nitems : 1) * sizeof(int));
+
+    for(w = 0, next = 0; w < nworkers; ++w) {
+        struct pool_deque *d = &p->deques[w];
+
+        pthread_mutex_init(&d->lock, NULL);
+        d->items = p->items + next;
+        d->head = d->tail = 0;
+        for(i = w; i < nitems; i += nworkers) d->items[d->tail++] = i;
+        next += d->tail;
+    }
+
+    for(w = 0; w < nworkers; ++w) {
+        struct pool_worker *pw = pool_malloc(sizeof(struct pool_worker));
+
+        pw->p = p;
+        pw->id = w;
+        if(pthread_create(&p->threads[w], NULL, pool_main, pw)) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    return p;
+}
+
+void pool_join(struct pool *p) {
+    int w;
+
+    for(w = 0; w < p->nworkers; ++w) {
+        pthread_join(p->threads[w], NULL);
+        pthread_mutex_destroy(&p->deques[w].lock);
+    }
+
+    free(p->items);
+    free(p->deques);
+    free(p->threads);
+    free(p);
+}
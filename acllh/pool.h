@@ -0,0 +1,37 @@
+#ifndef __ACLLH_POOL_H
+#define __ACLLH_POOL_H
+
+/*
+ *      Work-stealing thread pool
+ *
+ *      Items 0..n-1 are dealt round-robin onto one deque per worker.
+ *      A worker takes its own items from the front, in ascending order,
+ *      and steals from the back of another deque once its own runs dry.
+ *      Low-numbered items therefore finish first, which keeps an
+ *      in-order consumer busy.
+ */
+
+#include <pthread.h>
+
+typedef void (*pool_fn)(void *arg, int worker, int item);
+
+struct pool_deque {
+    pthread_mutex_t lock;
+    int *items;
+    int head;
+    int tail;
+};
+
+struct pool {
+    int nworkers;
+    pool_fn fn;
+    void *arg;
+    pthread_t *threads;
+    struct pool_deque *deques;
+    int *items;
+};
+
+struct pool *pool_start(int nworkers, int nitems, pool_fn fn, void *arg);
+void pool_join(struct pool *p);
+
+#endif
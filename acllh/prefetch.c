@@ -0,0 +1,366 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef ACLLH_URING
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#include "prefetch.h"
+
+static void *prefetch_alloc(size_t size) {
+    void *m = calloc(1, size ? size : 1);
+    if(!m) {
+        perror("acllh");
+        exit(1);
+    }
+    return m;
+}
+
+static int eligible(off_t size) {
+    return size > 0 && size <= PREFETCH_MAX_SIZE;
+}
+
+#define PREFETCH_FULL           -2
+
+/* the next file to read, waiting for room if asked to; -1 when none is left */
+static int take(struct prefetch *p, int wait) {
+    int i = -1;
+
+    pthread_mutex_lock(&p->lock);
+    // files not read ahead were done from the start
+    while(p->next < p->n && p->files[p->next].done) p->next++;
+    while(wait && p->next < p->n && p->outstanding == PREFETCH_DEPTH && !p->stop) {
+        pthread_cond_wait(&p->room, &p->lock);
+    }
+    if(p->next < p->n && !p->stop) {
+        if(p->outstanding < PREFETCH_DEPTH) {
+            i = p->next++;
+            p->files[i].taken = 1;
+            p->outstanding++;
+        } else {
+            i = PREFETCH_FULL;
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    if(i >= 0) p->files[i].data = prefetch_alloc(p->files[i].size + 2);
+    return i;
+}
+
+/* hand file i over, or leave it to be opened as usual */
+static void finish(struct prefetch *p, int i, int ok) {
+    struct prefetch_file *f = &p->files[i];
+
+    pthread_mutex_lock(&p->lock);
+    if(!ok) {
+        free(f->data);
+        f->data = NULL;
+    }
+    f->size = f->got;
+    f->done = 1;
+    pthread_cond_broadcast(&p->ready);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void read_plain(struct prefetch *p) {
+    int i;
+
+    while((i = take(p, 1)) >= 0) {
+        struct prefetch_file *f = &p->files[i];
+        int fd = open(p->paths[i], O_RDONLY | O_CLOEXEC);
+        ssize_t n = 0;
+
+        // a file that grew since the walk is read as far as it was then
+        while(fd >= 0 && f->got < f->size) {
+            n = read(fd, f->data + f->got, f->size - f->got);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) break;
+            f->got += n;
+        }
+        if(fd >= 0) close(fd);
+        finish(p, i, fd >= 0 && n >= 0);
+    }
+}
+
+#ifdef ACLLH_URING
+enum { URING_OPEN, URING_READ, URING_CLOSE };
+
+struct uring {
+    int fd;
+    unsigned entries;
+    unsigned tail;              // of the submission queue, ahead of *sq_tail until submitted
+    unsigned queued;            // entries not yet submitted
+    unsigned inflight;          // submitted and not yet completed
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+};
+
+static int uring_supported(int fd) {
+    static const int ops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+    struct io_uring_probe *probe = prefetch_alloc(sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+    int i, ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+
+    for(i = 0; ok && i < (int)(sizeof(ops) / sizeof(ops[0])); ++i) {
+        ok = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+static void uring_destroy(struct uring *r) {
+    if(r->sqes) munmap(r->sqes, r->sqes_len);
+    if(r->cq_ring && r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_len);
+    if(r->sq_ring) munmap(r->sq_ring, r->sq_len);
+    close(r->fd);
+}
+
+/* 0 when the kernel has a ring that opens, reads and closes files */
+static int uring_setup(struct uring *r, unsigned entries) {
+    struct io_uring_params params;
+    void *m;
+
+    memset(r, 0, sizeof(*r));
+    memset(&params, 0, sizeof(params));
+    r->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(r->fd < 0) return -1;
+    if(!uring_supported(r->fd)) goto fail;
+
+    r->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+    m = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if(m == MAP_FAILED) goto fail;
+    r->sq_ring = m;
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        m = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if(m == MAP_FAILED) goto fail;
+        r->cq_ring = m;
+    }
+    r->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    m = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if(m == MAP_FAILED) goto fail;
+    r->sqes = m;
+
+    r->entries = params.sq_entries;
+    r->sq_tail = (unsigned *)((char *)r->sq_ring + params.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_ring + params.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ring + params.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_ring + params.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_ring + params.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_ring + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ring + params.cq_off.cqes);
+    r->tail = *r->sq_tail;
+    return 0;
+
+fail:
+    uring_destroy(r);
+    return -1;
+}
+
+static struct io_uring_sqe *uring_queue(struct uring *r, int op, int fd) {
+    unsigned index = r->tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    r->sq_array[index] = index;
+    r->tail++;
+    r->queued++;
+    return sqe;
+}
+
+static void queue_read(struct uring *r, struct prefetch_file *f, int i) {
+    struct io_uring_sqe *sqe = uring_queue(r, IORING_OP_READ, f->fd);
+
+    sqe->addr = (uintptr_t)(f->data + f->got);
+    sqe->len = f->size - f->got;
+    sqe->off = f->got;
+    sqe->user_data = (uint64_t)i << 2 | URING_READ;
+}
+
+/* submit what is queued and wait for at least one completion */
+static void uring_enter(struct uring *r) {
+    int n;
+
+    __atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+    do {
+        n = syscall(__NR_io_uring_enter, r->fd, r->queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    } while(n < 0 && errno == EINTR);
+    if(n < 0) {
+        // the ring never holds more than it has room for, so this is not expected
+        perror("io_uring_enter");
+        exit(1);
+    }
+    r->queued -= n;
+    r->inflight += n;
+}
+
+static void complete(struct prefetch *p, struct uring *r, const struct io_uring_cqe *cqe) {
+    int i = cqe->user_data >> 2;
+    struct prefetch_file *f = &p->files[i];
+
+    r->inflight--;
+    switch(cqe->user_data & 3) {
+        case URING_OPEN:
+            if(cqe->res < 0) {
+                finish(p, i, 0);
+                break;
+            }
+            f->fd = cqe->res;
+            queue_read(r, f, i);
+            break;
+        case URING_READ:
+            if(cqe->res > 0) f->got += cqe->res;
+            if(cqe->res > 0 && f->got < f->size) {
+                queue_read(r, f, i);
+                break;
+            }
+            uring_queue(r, IORING_OP_CLOSE, f->fd)->user_data = (uint64_t)i << 2 | URING_CLOSE;
+            finish(p, i, cqe->res >= 0);
+            break;
+        case URING_CLOSE:
+            break;
+    }
+}
+
+/*
+ * Every file goes through an open, one or more reads and a close, each
+ * queued as soon as the one before completes. A completion frees the
+ * entry the next step of its file takes, so with opens started only
+ * while the ring has room the queues never overflow.
+ */
+static void read_uring(struct prefetch *p, struct uring *r) {
+    struct io_uring_sqe *sqe;
+    unsigned head;
+    int i, more = 1;
+
+    for(;;) {
+        while(more && r->inflight + r->queued < r->entries) {
+            // block for room only when nothing is left to wait for in the kernel
+            i = take(p, !r->inflight && !r->queued);
+            if(i == PREFETCH_FULL) break;
+            if(i < 0) {
+                more = 0;
+                break;
+            }
+            sqe = uring_queue(r, IORING_OP_OPENAT, AT_FDCWD);
+            sqe->addr = (uintptr_t)p->paths[i];
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            sqe->user_data = (uint64_t)i << 2 | URING_OPEN;
+        }
+        if(!r->inflight && !r->queued) break;
+
+        uring_enter(r);
+        head = *r->cq_head;
+
+        while(head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+            complete(p, r, &r->cqes[head & *r->cq_mask]);
+            head++;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+#endif
+
+static void *prefetch_main(void *arg) {
+    struct prefetch *p = arg;
+#ifdef ACLLH_URING
+    struct uring r;
+
+    if(uring_setup(&r, PREFETCH_DEPTH * 2) == 0) {
+        p->uring = 1;
+        read_uring(p, &r);
+        uring_destroy(&r);
+        return NULL;
+    }
+#endif
+    read_plain(p);
+    return NULL;
+}
+
+struct prefetch *prefetch_start(char **paths, const off_t *sizes, int n) {
+    struct prefetch *p = prefetch_alloc(sizeof(struct prefetch));
+    int i;
+
+    p->paths = paths;
+    p->n = n;
+    p->files = prefetch_alloc(n * sizeof(struct prefetch_file));
+    for(i = 0; i < n; ++i) {
+        p->files[i].size = eligible(sizes[i]) ? sizes[i] : 0;
+        p->files[i].done = !eligible(sizes[i]);
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->ready, NULL);
+    pthread_cond_init(&p->room, NULL);
+    if(pthread_create(&p->thread, NULL, prefetch_main, p)) {
+        perror("pthread_create");
+        exit(1);
+    }
+    return p;
+}
+
+/* file i as read ahead, once it is; NULL when it is to be opened as usual */
+char *prefetch_get(struct prefetch *p, int i, size_t *size) {
+    struct prefetch_file *f = &p->files[i];
+
+    pthread_mutex_lock(&p->lock);
+    while(!f->done) pthread_cond_wait(&p->ready, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+
+    *size = f->size;
+    return f->data;
+}
+
+/* done with file i, whether or not it was read ahead */
+void prefetch_release(struct prefetch *p, int i) {
+    struct prefetch_file *f = &p->files[i];
+
+    pthread_mutex_lock(&p->lock);
+    free(f->data);
+    f->data = NULL;
+    if(f->taken) {
+        f->taken = 0;
+        p->outstanding--;
+        pthread_cond_signal(&p->room);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+void prefetch_stop(struct prefetch *p) {
+    int i;
+
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_signal(&p->room);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+
+    for(i = 0; i < p->n; ++i) free(p->files[i].data);
+    pthread_cond_destroy(&p->room);
+    pthread_cond_destroy(&p->ready);
+    pthread_mutex_destroy(&p->lock);
+    free(p->files);
+    free(p);
+}
@@ -0,0 +1,51 @@
+#ifndef __ACLLH_PREFETCH_H
+#define __ACLLH_PREFETCH_H
+
+/*
+ *      Read-ahead of small files
+ *
+ *      A thread of its own opens, reads and closes the small regular files
+ *      of a list in list order, keeping up to PREFETCH_DEPTH of them in
+ *      memory ahead of the scanners, which then lex each one in place.
+ *      With io_uring the opens, reads and closes of a whole window go to
+ *      the kernel in one io_uring_enter() instead of three syscalls per
+ *      file. It is driven through the raw system calls; where the kernel,
+ *      a seccomp filter or the build (ACLLH_URING) rules it out, the same
+ *      thread reads with plain open() and read().
+ */
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#define PREFETCH_DEPTH          64              // files read but not yet released
+#define PREFETCH_MAX_SIZE       (64 * 1024)     // larger files are mapped or streamed as before
+
+struct prefetch_file {
+    char *data;                 // size bytes and two NULs, NULL when the file is to be opened as usual
+    size_t size;                // expected from the walk until the file is read
+    size_t got;
+    int fd;
+    int taken;                  // counted against PREFETCH_DEPTH until released
+    int done;
+};
+
+struct prefetch {
+    char **paths;
+    int n;
+    struct prefetch_file *files;
+    int next;                   // first file not yet taken by the reader
+    int outstanding;            // taken and not released
+    int stop;
+    int uring;                  // 1 when io_uring does the reading
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;       // a file was read
+    pthread_cond_t room;        // a file was released or the reader should stop
+};
+
+struct prefetch *prefetch_start(char **paths, const off_t *sizes, int n);
+char *prefetch_get(struct prefetch *p, int i, size_t *size);
+void prefetch_release(struct prefetch *p, int i);
+void prefetch_stop(struct prefetch *p);
+
+#endif
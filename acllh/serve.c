@@ -0,0 +1,575 @@
+/*
+ *      A C-Like Language Lexical Highlighter - server mode
+ *
+ *      Listens on a UNIX domain socket and highlights on behalf of
+ *      clients with a fixed set of warm scanners, one per worker thread.
+ *      A worker takes one request of a connection at a time. Between
+ *      requests the connection waits in the accepting thread's poll set,
+ *      so idle clients, however many, hold no scanner.
+ *
+ *      Requests, any number per connection:
+ *
+ *          FILE <path>\n                   highlight a file the server can read
+ *          DATA <length>\n<bytes>          highlight the bytes that follow
+ *          STATS\n                         request latency so far
+ *
+ *      Responses:
+ *
+ *          OK <length>\n<text><json>\n     highlighted text, then its counters
+ *          ERR <message>\n
+ *
+ *      The JSON line of a STATS response holds the request count and the
+ *      p50/p99/max latency in microseconds, from the end of reading a
+ *      request to the end of writing its response.
+ */
+
+#define _GNU_SOURCE             // ppoll, pipe2
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "acllh.h"
+
+#define SERVE_LINE_MAX          4096
+#define SERVE_DATA_MAX          (256 * 1024 * 1024)
+#define SERVE_SAMPLES           65536   // latency samples kept, the most recent ones
+#define SERVE_STALL_SECONDS     10      // a client stalling this long within a request is dropped
+
+struct conn_reader {
+    int fd;
+    size_t pos;
+    size_t len;
+    char buf[SERVE_LINE_MAX];
+};
+
+struct server {
+    const struct acllh_backend *backend;
+    struct acllh_ctx *ctxs;
+    struct conn_reader **active; // connection each worker is serving, NULL if none
+    int nworkers;
+
+    // connections with a request to read, waiting for a worker
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct conn_reader **queue;
+    int queue_head;
+    int queue_len;
+    int queue_cap;
+    int closing;
+
+    // connections between requests, polled by the accepting thread
+    struct conn_reader **idle;
+    int idle_len;
+    int idle_cap;
+    int wake[2];                // a worker adding to idle writes a byte here
+
+    // latency samples in microseconds, a ring of SERVE_SAMPLES
+    pthread_mutex_t stats_lock;
+    uint32_t *samples;
+    long requests;
+};
+
+struct worker_arg {
+    struct server *srv;
+    int id;
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static uint64_t now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int write_full(int fd, const char *s, size_t n) {
+    while(n > 0) {
+        ssize_t w = write(fd, s, n);
+
+        if(w < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        s += w;
+        n -= w;
+    }
+    return 0;
+}
+
+static int write_line(int fd, const char *fmt, const char *arg) {
+    char line[SERVE_LINE_MAX];
+    int n = snprintf(line, sizeof(line), fmt, arg);
+
+    if(n < 0 || n >= (int)sizeof(line)) n = sizeof(line) - 1;
+    return write_full(fd, line, n);
+}
+
+static ssize_t reader_fill(struct conn_reader *r) {
+    ssize_t n;
+
+    if(r->pos > 0) {
+        memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+    }
+    do {
+        n = read(r->fd, r->buf + r->len, sizeof(r->buf) - r->len);
+    } while(n < 0 && errno == EINTR);
+    if(n > 0) r->len += n;
+    return n;
+}
+
+/* next line without its newline, or NULL at end of input or on an overlong line */
+static char *reader_line(struct conn_reader *r) {
+    for(;;) {
+        char *nl = memchr(r->buf + r->pos, '\n', r->len - r->pos);
+
+        if(nl) {
+            char *line = r->buf + r->pos;
+
+            *nl = '\0';
+            r->pos = nl + 1 - r->buf;
+            return line;
+        }
+        if(r->len - r->pos == sizeof(r->buf) || reader_fill(r) <= 0) return NULL;
+    }
+}
+
+static int reader_bytes(struct conn_reader *r, char *dst, size_t n) {
+    size_t have = r->len - r->pos;
+
+    if(have > n) have = n;
+    memcpy(dst, r->buf + r->pos, have);
+    r->pos += have;
+    dst += have;
+    n -= have;
+
+    while(n > 0) {
+        ssize_t got = read(r->fd, dst, n);
+
+        if(got < 0 && errno == EINTR) continue;
+        if(got <= 0) return -1;
+        dst += got;
+        n -= got;
+    }
+    return 0;
+}
+
+static void record_latency(struct server *srv, uint64_t usec) {
+    pthread_mutex_lock(&srv->stats_lock);
+    srv->samples[srv->requests % SERVE_SAMPLES] = usec > UINT32_MAX ? UINT32_MAX : usec;
+    srv->requests++;
+    pthread_mutex_unlock(&srv->stats_lock);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void latency_json(struct server *srv, char *buf, size_t size) {
+    uint32_t *sorted;
+    long requests;
+    size_t n;
+
+    pthread_mutex_lock(&srv->stats_lock);
+    requests = srv->requests;
+    n = requests < SERVE_SAMPLES ? requests : SERVE_SAMPLES;
+    sorted = malloc((n ? n : 1) * sizeof(uint32_t));
+    if(sorted) memcpy(sorted, srv->samples, n * sizeof(uint32_t));
+    pthread_mutex_unlock(&srv->stats_lock);
+
+    if(!sorted || !n) {
+        snprintf(buf, size, "{\"requests\": %ld}", requests);
+        free(sorted);
+        return;
+    }
+
+    qsort(sorted, n, sizeof(uint32_t), cmp_u32);
+    snprintf(buf, size, "{\"requests\": %ld, \"p50_us\": %u, \"p99_us\": %u, \"max_us\": %u}",
+             requests, sorted[(n - 1) / 2], sorted[(n - 1) * 99 / 100], sorted[n - 1]);
+    free(sorted);
+}
+
+static void discard(struct acllh_ctx *ctx) {
+    size_t len;
+
+    free(out_take(&ctx->text, &len));
+    free(out_take(&ctx->log, &len));
+}
+
+/* the scanner has written one request's text and log; send the text and the counters */
+static int respond(int fd, struct acllh_ctx *ctx) {
+    char head[64], json[SERVE_LINE_MAX];
+    size_t text_len, log_len;
+    char *text = out_take(&ctx->text, &text_len);
+    int n, ret;
+
+    // the log is not part of the protocol
+    free(out_take(&ctx->log, &log_len));
+
+    n = acllh_stats_json(json, sizeof(json) - 1, &ctx->stats);
+    json[n++] = '\n';
+    snprintf(head, sizeof(head), "OK %zu\n", text_len);
+
+    ret = write_full(fd, head, strlen(head));
+    if(!ret) ret = write_full(fd, text ? text : "", text_len);
+    if(!ret) ret = write_full(fd, json, n);
+    free(text);
+    return ret;
+}
+
+/* one request from r; -1 when the connection is done with */
+static int serve_request(struct server *srv, struct acllh_ctx *ctx, struct conn_reader *r) {
+    char *line = reader_line(r);
+    int fd = r->fd;
+    uint64_t start = now_usec();
+    int ret;
+
+    if(!line) return -1;
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+
+    if(!strncmp(line, "FILE ", 5)) {
+        if(srv->backend->scan_file(ctx, line + 5) < 0) {
+            discard(ctx);
+            ret = write_line(fd, "ERR cannot read %s\n", line + 5);
+        } else {
+            ret = respond(fd, ctx);
+        }
+    } else if(!strncmp(line, "DATA ", 5)) {
+        char *end;
+        long len = strtol(line + 5, &end, 10);
+        char *data;
+
+        if(*end || len < 0 || len > SERVE_DATA_MAX || !(data = malloc(len ? len : 1))) {
+            write_line(fd, "ERR bad length %s\n", line + 5);
+            return -1;
+        }
+        if(reader_bytes(r, data, len) < 0) {
+            free(data);
+            return -1;
+        }
+        start = now_usec();
+        srv->backend->scan_chunk(ctx, data, len, 0, 1, ACLLH_INITIAL,
+                                 ACLLH_CHUNK_FIRST | ACLLH_CHUNK_LAST);
+        free(data);
+        ret = respond(fd, ctx);
+    } else if(!strcmp(line, "STATS")) {
+        char json[SERVE_LINE_MAX];
+
+        latency_json(srv, json, sizeof(json));
+        return write_line(fd, "OK 0\n%s\n", json);
+    } else {
+        ret = write_line(fd, "ERR unknown request %s\n", line);
+    }
+
+    if(ret < 0) return -1;
+    record_latency(srv, now_usec() - start);
+    return 0;
+}
+
+static void drop(struct conn_reader *r) {
+    close(r->fd);
+    free(r);
+}
+
+/* srv->lock held */
+static int queue_push(struct server *srv, struct conn_reader *r) {
+    if(srv->queue_len == srv->queue_cap) {
+        int cap = srv->queue_cap * 2, i;
+        struct conn_reader **queue = malloc(cap * sizeof(*queue));
+
+        if(!queue) return -1;
+        for(i = 0; i < srv->queue_len; ++i) queue[i] = srv->queue[(srv->queue_head + i) % srv->queue_cap];
+        free(srv->queue);
+        srv->queue = queue;
+        srv->queue_head = 0;
+        srv->queue_cap = cap;
+    }
+    srv->queue[(srv->queue_head + srv->queue_len) % srv->queue_cap] = r;
+    srv->queue_len++;
+    pthread_cond_signal(&srv->cond);
+    return 0;
+}
+
+/* srv->lock held */
+static int idle_push(struct server *srv, struct conn_reader *r) {
+    if(srv->idle_len == srv->idle_cap) {
+        int cap = srv->idle_cap ? srv->idle_cap * 2 : 64;
+        struct conn_reader **idle = realloc(srv->idle, cap * sizeof(*idle));
+
+        if(!idle) return -1;
+        srv->idle = idle;
+        srv->idle_cap = cap;
+    }
+    srv->idle[srv->idle_len++] = r;
+    // fails only when the pipe is full, and then the accepting thread is awake anyway
+    if(write(srv->wake[1], "", 1) < 0) return 0;
+    return 0;
+}
+
+static void *serve_worker(void *p) {
+    struct worker_arg *arg = p;
+    struct server *srv = arg->srv;
+    struct acllh_ctx *ctx = &srv->ctxs[arg->id];
+
+    for(;;) {
+        struct conn_reader *r;
+        int keep;
+
+        pthread_mutex_lock(&srv->lock);
+        while(!srv->queue_len && !srv->closing) pthread_cond_wait(&srv->cond, &srv->lock);
+        if(!srv->queue_len) {
+            pthread_mutex_unlock(&srv->lock);
+            break;
+        }
+        r = srv->queue[srv->queue_head];
+        srv->queue_head = (srv->queue_head + 1) % srv->queue_cap;
+        srv->queue_len--;
+        srv->active[arg->id] = r;
+        pthread_mutex_unlock(&srv->lock);
+
+        keep = serve_request(srv, ctx, r) == 0;
+
+        // a request already read ahead goes to the back of the queue, otherwise wait for one
+        pthread_mutex_lock(&srv->lock);
+        srv->active[arg->id] = NULL;
+        if(keep && !srv->closing) keep = (r->pos < r->len ? queue_push(srv, r) : idle_push(srv, r)) == 0;
+        pthread_mutex_unlock(&srv->lock);
+        if(!keep) drop(r);
+    }
+    return NULL;
+}
+
+/* a new connection waits for its first request like any idle one */
+static void admit(struct server *srv, int fd) {
+    struct conn_reader *r = malloc(sizeof(struct conn_reader));
+    struct timeval stall = { SERVE_STALL_SECONDS, 0 };
+
+    if(!r) {
+        close(fd);
+        return;
+    }
+    r->fd = fd;
+    r->pos = r->len = 0;
+    // bounds a worker's wait on a client that stops halfway through a request or its reply
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &stall, sizeof(stall));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &stall, sizeof(stall));
+
+    pthread_mutex_lock(&srv->lock);
+    if(idle_push(srv, r) < 0) {
+        pthread_mutex_unlock(&srv->lock);
+        drop(r);
+        return;
+    }
+    pthread_mutex_unlock(&srv->lock);
+}
+
+/* hands the idle connections that polled readable back to the workers */
+static void wake_idle(struct server *srv, const struct pollfd *pfds, int n) {
+    int i;
+
+    pthread_mutex_lock(&srv->lock);
+    // workers only append, so the first n are still the polled ones; from the back, a swapped-in one is done
+    for(i = n - 1; i >= 0; --i) {
+        struct conn_reader *r;
+
+        if(!pfds[i].revents) continue;
+        r = srv->idle[i];
+        srv->idle[i] = srv->idle[--srv->idle_len];
+        if(queue_push(srv, r) < 0) drop(r);
+    }
+    pthread_mutex_unlock(&srv->lock);
+}
+
+static int listen_on(const char *path) {
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // a socket left behind by an earlier server is replaced, anything else is not
+    if(!lstat(path, &st) && S_ISSOCK(st.st_mode)) unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+        perror(path);
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int acllh_serve(const char *path, int workers, const struct acllh_backend *backend,
+                const struct out_style *style) {
+    struct server srv;
+    struct worker_arg *args;
+    pthread_t *threads;
+    struct pollfd *pfds = NULL;
+    struct sigaction sa;
+    sigset_t block, old;
+    char json[SERVE_LINE_MAX];
+    int i, lfd, npfds = 0;
+
+    lfd = listen_on(path);
+    if(lfd < 0) return -1;
+    // poll() says when to accept, and a client gone in between must not block it
+    fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK);
+
+    memset(&srv, 0, sizeof(srv));
+    srv.backend = backend;
+    srv.nworkers = workers;
+    srv.queue_cap = 64;
+    srv.queue = calloc(srv.queue_cap, sizeof(struct conn_reader *));
+    srv.samples = calloc(SERVE_SAMPLES, sizeof(uint32_t));
+    srv.ctxs = calloc(workers, sizeof(struct acllh_ctx));
+    srv.active = calloc(workers, sizeof(struct conn_reader *));
+    args = calloc(workers, sizeof(struct worker_arg));
+    threads = calloc(workers, sizeof(pthread_t));
+    if(!srv.queue || !srv.samples || !srv.ctxs || !srv.active || !args || !threads
+       || pipe2(srv.wake, O_NONBLOCK | O_CLOEXEC) < 0) {
+        perror("acllh");
+        exit(1);
+    }
+    pthread_mutex_init(&srv.lock, NULL);
+    pthread_cond_init(&srv.cond, NULL);
+    pthread_mutex_init(&srv.stats_lock, NULL);
+
+    for(i = 0; i < workers; ++i) {
+        if(backend->ctx_init(&srv.ctxs[i]) < 0) {
+            perror("acllh");
+            exit(1);
+        }
+        out_init_mem(&srv.ctxs[i].text);
+        srv.ctxs[i].text.style = style;
+        out_init_mem(&srv.ctxs[i].log);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // the signals stay blocked but in ppoll(), so a stop is never missed between the check and the wait
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    for(i = 0; i < workers; ++i) {
+        args[i].srv = &srv;
+        args[i].id = i;
+        pthread_create(&threads[i], NULL, serve_worker, &args[i]);
+    }
+
+    fprintf(stderr, "acllh: serving on %s with %d scanners\n", path, workers);
+
+    while(!stopping) {
+        int n;
+
+        // the wake pipe, the listening socket, then every idle connection
+        pthread_mutex_lock(&srv.lock);
+        n = srv.idle_len + 2;
+        if(n > npfds) {
+            struct pollfd *grown = realloc(pfds, 2 * n * sizeof(struct pollfd));
+
+            if(!grown) {
+                perror("acllh");
+                exit(1);
+            }
+            pfds = grown;
+            npfds = 2 * n;
+        }
+        for(i = 2; i < n; ++i) pfds[i].fd = srv.idle[i - 2]->fd;
+        pthread_mutex_unlock(&srv.lock);
+        pfds[0].fd = srv.wake[0];
+        pfds[1].fd = lfd;
+        for(i = 0; i < n; ++i) pfds[i].events = POLLIN;
+
+        if(ppoll(pfds, n, NULL, &old) < 0) {
+            if(errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        if(pfds[0].revents) {
+            char drain[64];
+
+            while(read(srv.wake[0], drain, sizeof(drain)) > 0);
+        }
+        if(pfds[1].revents) {
+            int fd = accept(lfd, NULL, NULL);
+
+            if(fd >= 0) {
+                admit(&srv, fd);
+            } else if(errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+                perror("accept");
+                break;
+            }
+        }
+        wake_idle(&srv, pfds + 2, n - 2);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    close(lfd);
+    unlink(path);
+
+    // drop the connections waiting for a worker or a request, finish the
+    // request in progress on the others, then let the workers go
+    pthread_mutex_lock(&srv.lock);
+    srv.closing = 1;
+    for(; srv.queue_len; srv.queue_len--) {
+        drop(srv.queue[srv.queue_head]);
+        srv.queue_head = (srv.queue_head + 1) % srv.queue_cap;
+    }
+    for(i = 0; i < srv.idle_len; ++i) drop(srv.idle[i]);
+    srv.idle_len = 0;
+    for(i = 0; i < workers; ++i) {
+        if(srv.active[i]) shutdown(srv.active[i]->fd, SHUT_RD);
+    }
+    pthread_cond_broadcast(&srv.cond);
+    pthread_mutex_unlock(&srv.lock);
+    for(i = 0; i < workers; ++i) pthread_join(threads[i], NULL);
+
+    latency_json(&srv, json, sizeof(json));
+    fprintf(stderr, "acllh: latency %s\n", json);
+
+    for(i = 0; i < workers; ++i) backend->ctx_destroy(&srv.ctxs[i]);
+    pthread_cond_destroy(&srv.cond);
+    pthread_mutex_destroy(&srv.lock);
+    pthread_mutex_destroy(&srv.stats_lock);
+    free(threads);
+    free(args);
+    free(srv.ctxs);
+    free(srv.active);
+    free(srv.samples);
+    free(srv.queue);
+    free(srv.idle);
+    free(pfds);
+    close(srv.wake[0]);
+    close(srv.wake[1]);
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "span.h"
+
+#ifdef SPAN_X86
+#include <immintrin.h>
+#endif
+
+#define STOP_COMMENT(c)         ((c) == '*' || (c) == '\n')
+#define STOP_STRING(c)          ((c) == '"' || (c) == '\\' || (c) == '\n')
+#define STOP_LINE(c)            ((c) == '\n')
+#define STOP_BLANK(c)           ((c) != ' ' && (c) != '\t')
+
+#define SCALAR_SPAN(name, STOP) \
+    static size_t scalar_##name(const char *p, const char *end) { \
+        const char *s = p; \
+        while(p < end && !STOP(*p)) p++; \
+        return p - s; \
+    }
+
+SCALAR_SPAN(comment, STOP_COMMENT)
+SCALAR_SPAN(string, STOP_STRING)
+SCALAR_SPAN(line, STOP_LINE)
+SCALAR_SPAN(blank, STOP_BLANK)
+
+const struct span_kernels span_scalar = {
+    "scalar", scalar_comment, scalar_string, scalar_line, scalar_blank,
+};
+
+#ifdef SPAN_X86
+
+/*
+ * A mask function turns one vector of input into a bit per byte that is
+ * set for stop bytes; the lowest set bit is the end of the run.
+ */
+#define VECTOR_SPAN(isa, name, vec, width, load) \
+    __attribute__((target(#isa))) \
+    static size_t isa##_##name(const char *p, const char *end) { \
+        const char *s = p; \
+        while(end - p >= width) { \
+            unsigned int m = isa##_mask_##name(load((const vec *)p)); \
+            if(m) return p - s + __builtin_ctz(m); \
+            p += width; \
+        } \
+        return p - s + scalar_##name(p, end); \
+    }
+
+#define SSE2_EQ(v, c)           _mm_cmpeq_epi8((v), _mm_set1_epi8(c))
+
+__attribute__((target("sse2")))
+static inline unsigned int sse2_mask_comment(__m128i v) {
+    return _mm_movemask_epi8(_mm_or_si128(SSE2_EQ(v, '*'), SSE2_EQ(v, '\n')));
+}
+
+__attribute__((target("sse2")))
+static inline unsigned int sse2_mask_string(__m128i v) {
+    return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(SSE2_EQ(v, '"'), SSE2_EQ(v, '\\')),
+                                          SSE2_EQ(v, '\n')));
+}
+
+__attribute__((target("sse2")))
+static inline unsigned int sse2_mask_line(__m128i v) {
+    return _mm_movemask_epi8(SSE2_EQ(v, '\n'));
+}
+
+__attribute__((target("sse2")))
+static inline unsigned int sse2_mask_blank(__m128i v) {
+    return ~_mm_movemask_epi8(_mm_or_si128(SSE2_EQ(v, ' '), SSE2_EQ(v, '\t'))) & 0xffff;
+}
+
+VECTOR_SPAN(sse2, comment, __m128i, 16, _mm_loadu_si128)
+VECTOR_SPAN(sse2, string, __m128i, 16, _mm_loadu_si128)
+VECTOR_SPAN(sse2, line, __m128i, 16, _mm_loadu_si128)
+VECTOR_SPAN(sse2, blank, __m128i, 16, _mm_loadu_si128)
+
+const struct span_kernels span_sse2 = {
+    "sse2", sse2_comment, sse2_string, sse2_line, sse2_blank,
+};
+
+#define AVX2_EQ(v, c)           _mm256_cmpeq_epi8((v), _mm256_set1_epi8(c))
+
+__attribute__((target("avx2")))
+static inline unsigned int avx2_mask_comment(__m256i v) {
+    return _mm256_movemask_epi8(_mm256_or_si256(AVX2_EQ(v, '*'), AVX2_EQ(v, '\n')));
+}
+
+__attribute__((target("avx2")))
+static inline unsigned int avx2_mask_string(__m256i v) {
+    return _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(AVX2_EQ(v, '"'), AVX2_EQ(v, '\\')),
+                                                AVX2_EQ(v, '\n')));
+}
+
+__attribute__((target("avx2")))
+static inline unsigned int avx2_mask_line(__m256i v) {
+    return _mm256_movemask_epi8(AVX2_EQ(v, '\n'));
+}
+
+__attribute__((target("avx2")))
+static inline unsigned int avx2_mask_blank(__m256i v) {
+    return ~_mm256_movemask_epi8(_mm256_or_si256(AVX2_EQ(v, ' '), AVX2_EQ(v, '\t')));
+}
+
+VECTOR_SPAN(avx2, comment, __m256i, 32, _mm256_loadu_si256)
+VECTOR_SPAN(avx2, string, __m256i, 32, _mm256_loadu_si256)
+VECTOR_SPAN(avx2, line, __m256i, 32, _mm256_loadu_si256)
+VECTOR_SPAN(avx2, blank, __m256i, 32, _mm256_loadu_si256)
+
+const struct span_kernels span_avx2 = {
+    "avx2", avx2_comment, avx2_string, avx2_line, avx2_blank,
+};
+
+#endif
+
+const struct span_kernels *span = &span_scalar;
+
+const struct span_kernels *span_best(void) {
+#ifdef SPAN_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return &span_avx2;
+    if(__builtin_cpu_supports("sse2")) return &span_sse2;
+#endif
+    return &span_scalar;
+}
@@ -0,0 +1,43 @@
+#ifndef __ACLLH_SPAN_H
+#define __ACLLH_SPAN_H
+
+/*
+ *      Run-length kernels for the scanner's hot states
+ *
+ *      Each kernel returns how many bytes from p on belong to the run,
+ *      i.e. the offset of the first stop byte, or end - p if there is none:
+ *
+ *          comment     stops at '*' or '\n'            (BLOCKCOMMENT body)
+ *          string      stops at '"', '\\' or '\n'      (BLOCKSTRING body)
+ *          line        stops at '\n'                   (LINECOMMENT body)
+ *          blank       stops at anything but ' ', '\t' (indentation)
+ *
+ *      The scalar set always works; SSE2 and AVX2 sets look at 16 or 32
+ *      bytes per step and are picked at runtime by span_best().
+ */
+
+#include <stddef.h>
+
+typedef size_t (*span_fn)(const char *p, const char *end);
+
+struct span_kernels {
+    const char *name;
+    span_fn comment;
+    span_fn string;
+    span_fn line;
+    span_fn blank;
+};
+
+extern const struct span_kernels span_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+#define SPAN_X86                1
+extern const struct span_kernels span_sse2;
+extern const struct span_kernels span_avx2;
+#endif
+
+/* the set the scanner uses; set once before any scanning starts */
+extern const struct span_kernels *span;
+
+const struct span_kernels *span_best(void);
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ *      tok2txt - turn an output.tok token stream back into output.txt
+ *
+ *      The stream stores positions only, so the sources must still be
+ *      where acllh found them. Records of standard input ("-") are
+ *      resolved against this program's standard input, and those of a
+ *      .gz or .zst source against its decompressed text.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "decompress.h"
+#include "tokstream.h"
+
+static char *read_all(int fd, size_t *len) {
+    size_t cap = 64 * 1024, n = 0;
+    char *buf = malloc(cap);
+    ssize_t r;
+
+    while(buf && (r = read(fd, buf + n, cap - n)) > 0) {
+        n += r;
+        if(n == cap) buf = realloc(buf, cap *= 2);
+    }
+    if(!buf) {
+        perror("tok2txt");
+        exit(1);
+    }
+    *len = n;
+    return buf;
+}
+
+/* the text acllh scanned; a damaged file still gives what came out before the damage, as it did there */
+static char *read_compressed(const char *path, int fd, enum decomp_kind kind, size_t *len) {
+    size_t cap = 64 * 1024, n = 0, r;
+    struct decomp d;
+    char *buf;
+    FILE *f;
+
+    if(decomp_open(&d, fd, kind) < 0) return NULL;
+    if(!(f = decomp_fopen(&d))) {
+        decomp_close(&d);
+        return NULL;
+    }
+    buf = malloc(cap);
+    while(buf && (r = fread(buf + n, 1, cap - n, f)) > 0) {
+        n += r;
+        if(n == cap) buf = realloc(buf, cap *= 2);
+    }
+    fclose(f);
+    if(decomp_close(&d) < 0) fprintf(stderr, "%s: corrupt or truncated %s data\n", path, decomp_name(kind));
+    if(!buf) {
+        perror("tok2txt");
+        exit(1);
+    }
+    *len = n;
+    return buf;
+}
+
+static int convert_file(const struct tok_file_view *f, FILE *out) {
+    char *path = strndup(f->path, f->path_len);
+    int is_stdin = !strcmp(path, "-");
+    enum decomp_kind kind = is_stdin ? DECOMP_NONE : decomp_kind(path);
+    size_t len;
+    char *src;
+    uint64_t i;
+    int fd;
+
+    fd = is_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+    if(fd < 0) {
+        perror(path);
+        free(path);
+        return -1;
+    }
+    if(kind) {
+        // decomp_close() closes fd
+        if(!(src = read_compressed(path, fd, kind, &len))) {
+            perror(path);
+            free(path);
+            return -1;
+        }
+    } else {
+        src = read_all(fd, &len);
+        if(!is_stdin) close(fd);
+    }
+
+    if(!is_stdin) fprintf(out, "------     %s     ------\n\n", path);
+
+    for(i = 0; i < f->nrecords; ++i) {
+        const struct tok_record *r = &f->records[i];
+        const struct tok_label *l;
+
+        if(r->kind == 0 || r->kind >= TOK_KINDS || r->offset > len || r->length > len - r->offset) {
+            fprintf(stderr, "%s: record %llu does not match the source\n", path, (unsigned long long)i);
+            free(src);
+            free(path);
+            return -1;
+        }
+
+        l = &tok_labels[r->kind];
+        fprintf(out, "[%4u", r->line);
+        fwrite(l->head, 1, l->head_len, out);
+        if(r->id != TOK_NO_ID) {
+            fprintf(out, "%2u", r->id);
+            fwrite(l->tail, 1, l->tail_len, out);
+        }
+        fwrite(src + r->offset, 1, r->length, out);
+        putc('\n', out);
+    }
+
+    if(!is_stdin) fputs("\n\n", out);
+
+    free(src);
+    free(path);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    struct tok_stream ts;
+    uint32_t i;
+    int ret = 0;
+
+    if(argc != 2) {
+        fprintf(stderr, "usage: %s output.tok > output.txt\n", argv[0]);
+        return 1;
+    }
+
+    if(tok_open(&ts, argv[1]) < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    for(i = 0; i < ts.nfiles; ++i) {
+        if(convert_file(&ts.files[i], stdout) < 0) ret = 1;
+    }
+
+    tok_close(&ts);
+    return ret;
+}
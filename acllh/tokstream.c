@@ -0,0 +1,179 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tokstream.h"
+
+#define LABEL(head, tail)       { head, sizeof(head) - 1, tail, sizeof(tail) - 1 }
+
+const struct tok_label tok_labels[TOK_KINDS] = {
+    [TOK_MACRO]             = LABEL("]macro:              ", ""),
+    [TOK_COMMENT]           = LABEL("]comment:            ", ""),
+    [TOK_CONSTANT]          = LABEL("]constant:           ", ""),
+    [TOK_OPERATOR]          = LABEL("]operator(",           "):       "),
+    [TOK_RESERVED_WORD]     = LABEL("]reserved word(",      "):  "),
+    [TOK_IDENTIFIER]        = LABEL("]identifier:         ", ""),
+    [TOK_DELIMITER]         = LABEL("]delimiter:          ", ""),
+    [TOK_EXTRA]             = LABEL("]extra symbol:       ", ""),
+    [TOK_INVALID_SYMBOL]    = LABEL("]invalid symbol:     ", ""),
+};
+
+#define TOK_ALIGN(n)            (((n) + 7) & ~(size_t)7)
+
+static int write_at(int fd, const void *buf, size_t n, off_t off) {
+    const char *p = buf;
+
+    while(n > 0) {
+        ssize_t w = pwrite(fd, p, n, off);
+
+        if(w < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        off += w;
+        n -= w;
+    }
+    return 0;
+}
+
+/*
+ * Reserve the header and leave fd positioned at the first record. The
+ * header is rewritten with the final counts by tok_writer_close().
+ */
+int tok_writer_open(struct tok_writer *w, int fd) {
+    struct tok_header h;
+
+    memset(w, 0, sizeof(*w));
+    w->fd = fd;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TOK_MAGIC, 4);
+    if(write_at(fd, &h, sizeof(h), 0) < 0) return -1;
+    return lseek(fd, sizeof(h), SEEK_SET) < 0 ? -1 : 0;
+}
+
+void tok_writer_file(struct tok_writer *w, const char *path, uint64_t nrecords) {
+    size_t path_len = strlen(path);
+    size_t need = sizeof(struct tok_file) + TOK_ALIGN(path_len);
+    struct tok_file *f;
+
+    if(w->table_len + need > w->table_cap) {
+        size_t cap = w->table_cap ? w->table_cap : 4096;
+
+        while(cap < w->table_len + need) cap *= 2;
+        w->table = realloc(w->table, cap);
+        if(!w->table) {
+            perror("acllh");
+            exit(1);
+        }
+        w->table_cap = cap;
+    }
+
+    f = (struct tok_file *)(w->table + w->table_len);
+    memset(f, 0, need);
+    f->first_record = w->nrecords;
+    f->nrecords = nrecords;
+    f->path_len = path_len;
+    memcpy(f + 1, path, path_len);
+
+    w->table_len += need;
+    w->nrecords += nrecords;
+    w->nfiles++;
+}
+
+/* call once every record has reached the file */
+int tok_writer_close(struct tok_writer *w) {
+    struct tok_header h;
+    int ret;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TOK_MAGIC, 4);
+    h.version = TOK_VERSION;
+    h.record_size = sizeof(struct tok_record);
+    h.nfiles = w->nfiles;
+    h.nrecords = w->nrecords;
+    h.files_offset = sizeof(h) + w->nrecords * sizeof(struct tok_record);
+
+    ret = write_at(w->fd, w->table, w->table_len, h.files_offset);
+    if(!ret) ret = write_at(w->fd, &h, sizeof(h), 0);
+
+    free(w->table);
+    w->table = NULL;
+    w->table_len = w->table_cap = 0;
+
+    return ret;
+}
+
+int tok_open(struct tok_stream *ts, const char *path) {
+    struct stat st;
+    const char *p, *end;
+    uint32_t i;
+    int fd = open(path, O_RDONLY);
+
+    memset(ts, 0, sizeof(*ts));
+    if(fd < 0) return -1;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct tok_header)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    ts->size = st.st_size;
+    ts->base = mmap(NULL, ts->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(ts->base == MAP_FAILED) {
+        ts->base = NULL;
+        return -1;
+    }
+
+    ts->header = ts->base;
+    if(memcmp(ts->header->magic, TOK_MAGIC, 4) || ts->header->version != TOK_VERSION
+       || ts->header->record_size != sizeof(struct tok_record)
+       || ts->header->files_offset > ts->size
+       || ts->header->nrecords > (ts->header->files_offset - sizeof(struct tok_header))
+                                 / sizeof(struct tok_record)) {
+        goto bad;
+    }
+
+    ts->records = (const struct tok_record *)(ts->header + 1);
+    ts->nfiles = ts->header->nfiles;
+    ts->files = calloc(ts->nfiles ? ts->nfiles : 1, sizeof(struct tok_file_view));
+    if(!ts->files) goto bad;
+
+    p = (const char *)ts->base + ts->header->files_offset;
+    end = (const char *)ts->base + ts->size;
+    for(i = 0; i < ts->nfiles; ++i) {
+        const struct tok_file *f = (const struct tok_file *)p;
+
+        if((size_t)(end - p) < sizeof(*f)
+           || (size_t)(end - p) - sizeof(*f) < f->path_len
+           || f->first_record > ts->header->nrecords
+           || f->nrecords > ts->header->nrecords - f->first_record) {
+            goto bad;
+        }
+        ts->files[i].path = (const char *)(f + 1);
+        ts->files[i].path_len = f->path_len;
+        ts->files[i].records = ts->records + f->first_record;
+        ts->files[i].nrecords = f->nrecords;
+        p += sizeof(*f) + TOK_ALIGN(f->path_len);
+        if(p > end) p = end;
+    }
+
+    return 0;
+
+bad:
+    tok_close(ts);
+    errno = EINVAL;
+    return -1;
+}
+
+void tok_close(struct tok_stream *ts) {
+    free(ts->files);
+    if(ts->base) munmap(ts->base, ts->size);
+    memset(ts, 0, sizeof(*ts));
+}
@@ -0,0 +1,108 @@
+#ifndef __ACLLH_TOKSTREAM_H
+#define __ACLLH_TOKSTREAM_H
+
+/*
+ *      Binary token stream (output.tok)
+ *
+ *      A memory-mappable alternative to output.txt:
+ *
+ *          struct tok_header
+ *          struct tok_record       [nrecords]
+ *          file table              [nfiles]: struct tok_file + path, padded to 8 bytes
+ *
+ *      Records carry the same tokens, in the same order, as the lines of
+ *      output.txt. The token text is not stored; (offset, length) point
+ *      into the source file named by the file table.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TOK_MAGIC               "ACLT"
+#define TOK_VERSION             1
+
+enum tok_kind {
+    TOK_MACRO = 1,
+    TOK_COMMENT,
+    TOK_CONSTANT,
+    TOK_OPERATOR,
+    TOK_RESERVED_WORD,
+    TOK_IDENTIFIER,
+    TOK_DELIMITER,
+    TOK_EXTRA,
+    TOK_INVALID_SYMBOL,
+    TOK_KINDS
+};
+
+#define TOK_NO_ID               0xffff
+
+struct tok_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t nfiles;
+    uint64_t nrecords;
+    uint64_t files_offset;
+};
+
+struct tok_record {
+    uint64_t offset;            // byte offset of the token in its file
+    uint32_t line;
+    uint32_t length;
+    uint16_t kind;              // enum tok_kind
+    uint16_t id;                // keyword or operator id, TOK_NO_ID otherwise
+    uint32_t reserved;
+};
+
+struct tok_file {
+    uint64_t first_record;
+    uint64_t nrecords;
+    uint32_t path_len;
+    uint32_t reserved;
+};
+
+/* output.txt labels: "[line" head [id tail] text */
+struct tok_label {
+    const char *head;
+    size_t head_len;
+    const char *tail;
+    size_t tail_len;
+};
+
+extern const struct tok_label tok_labels[TOK_KINDS];
+
+/* writer: records are appended by the caller, the writer keeps the file table */
+struct tok_writer {
+    int fd;
+    uint64_t nrecords;
+    uint32_t nfiles;
+    char *table;
+    size_t table_len;
+    size_t table_cap;
+};
+
+int tok_writer_open(struct tok_writer *w, int fd);
+void tok_writer_file(struct tok_writer *w, const char *path, uint64_t nrecords);
+int tok_writer_close(struct tok_writer *w);
+
+/* reader */
+struct tok_file_view {
+    const char *path;
+    uint32_t path_len;
+    const struct tok_record *records;
+    uint64_t nrecords;
+};
+
+struct tok_stream {
+    void *base;
+    size_t size;
+    const struct tok_header *header;
+    const struct tok_record *records;
+    uint32_t nfiles;
+    struct tok_file_view *files;
+};
+
+int tok_open(struct tok_stream *ts, const char *path);
+void tok_close(struct tok_stream *ts);
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ *      A C-Like Language Lexical Highlighter - watch mode
+ *
+ *      Highlights the given files once, then waits for them to be saved
+ *      and highlights only what changed. The directory of every file is
+ *      watched with inotify, so editors that save by renaming a new file
+ *      over the old one are seen as well as those writing in place.
+ *
+ *      The previous contents and the state every line starts in are kept
+ *      per file. After a save the common prefix and suffix of the two
+ *      versions are found; lexing restarts at the first changed line in
+ *      its old state and stops at the first line after the change that
+ *      starts in the state it had before, since from there on the old
+ *      highlighting is still right. Only those lines are written, as
+ *
+ *          <path>  @@ -A,N +A,M @@
+ *
+ *      followed by the M new lines that replace the N old lines from A.
+ *      Lines after the hunk only move by M - N.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "acllh.h"
+#include "decompress.h"
+
+#define WATCH_LOOKAHEAD         64      // lines lexed past the change before checking again
+#define WATCH_EVENTS_SIZE       (64 * 1024)
+
+struct watched {
+    char *path;
+    const char *name;           // last component, as inotify reports it
+    int wd;
+    char *text;                 // NULL until the file could be read
+    size_t size;
+    struct acllh_lines lines;   // states[i]: line i + 1, one more line than newlines
+};
+
+static void *watch_alloc(size_t size) {
+    void *m = calloc(1, size ? size : 1);
+    if(!m) {
+        perror("acllh");
+        exit(1);
+    }
+    return m;
+}
+
+void acllh_lines_grow(struct acllh_lines *l) {
+    l->cap = l->cap ? l->cap * 2 : 1024;
+    l->states = realloc(l->states, l->cap);
+    if(!l->states) {
+        perror("acllh");
+        exit(1);
+    }
+}
+
+static void lines_push(struct acllh_lines *l, int state) {
+    if(l->n == l->cap) acllh_lines_grow(l);
+    l->states[l->n++] = state;
+}
+
+static char *read_file(const char *path, size_t *size) {
+    struct stat st;
+    char *text;
+    size_t got = 0;
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if(fd >= 0) close(fd);
+        return NULL;
+    }
+    text = watch_alloc(st.st_size);
+    while(got < (size_t)st.st_size) {
+        ssize_t n = read(fd, text + got, st.st_size - got);
+
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0) {
+            perror(path);
+            free(text);
+            close(fd);
+            return NULL;
+        }
+        if(!n) break;           // truncated since the fstat
+        got += n;
+    }
+    close(fd);
+    *size = got;
+    return text;
+}
+
+static size_t count_lines(const char *p, const char *end) {
+    size_t n = 0;
+
+    while(p < end && (p = memchr(p, '\n', end - p))) {
+        n++;
+        p++;
+    }
+    return n;
+}
+
+/* offset of line `line`, walking from line `at`, which starts at `from` */
+static size_t line_offset(const char *text, size_t size, size_t from, size_t at, size_t line) {
+    const char *p = text + from, *end = text + size;
+
+    for(; at < line && p < end; ++at) {
+        const char *nl = memchr(p, '\n', end - p);
+
+        p = nl ? nl + 1 : end;
+    }
+    return p - text;
+}
+
+/*
+ * Append the states of the lines after the `len` bytes at `offset`, which
+ * start line `lineno` in `state`. The statistics-only scanner writes
+ * nothing, so this is the cheap pass.
+ */
+static void scan_states(struct acllh_ctx *skip, struct acllh_lines *l, const char *text,
+                        size_t offset, size_t len, size_t lineno, int state) {
+    skip->lines = l;
+    acllh_stats_backend.scan_chunk(skip, text + offset, len, offset, lineno, state, 0);
+    skip->lines = NULL;
+}
+
+/* write lines first..stop-1 as one hunk replacing `old` lines */
+static void render(struct acllh_ctx *ctx, const struct watched *w, size_t first, size_t stop,
+                   size_t old) {
+    size_t from = line_offset(w->text, w->size, 0, 1, first);
+    size_t to = line_offset(w->text, w->size, from, first, stop);
+    size_t len = to - from, text_len, log_len;
+    char *heading, *text, *log;
+
+    // the newline ending a hunk before the end of the file would number the next line
+    if(to < w->size && len) len--;
+
+    heading = watch_alloc(strlen(w->path) + 96);
+    sprintf(heading, "%s  @@ -%zu,%zu +%zu,%zu @@", w->path, first, old, first, stop - first);
+    out_file_begin(&ctx->text, heading);
+    free(heading);
+
+    acllh_full_backend.scan_chunk(ctx, w->text + from, len, from, first, w->lines.states[first - 1],
+                                  ACLLH_CHUNK_FIRST | ACLLH_CHUNK_LAST);
+    out_char(&ctx->text, '\n');
+    out_file_end(&ctx->text);
+
+    text = out_take(&ctx->text, &text_len);
+    log = out_take(&ctx->log, &log_len);
+    out_write(STDOUT_FILENO, text, text_len);
+    free(text);
+    free(log);
+}
+
+/* read the whole file and write all of it */
+static void load(struct acllh_ctx *skip, struct acllh_ctx *full, struct watched *w) {
+    w->text = read_file(w->path, &w->size);
+    if(!w->text) return;
+
+    w->lines.n = 0;
+    lines_push(&w->lines, ACLLH_INITIAL);
+    scan_states(skip, &w->lines, w->text, 0, w->size, 1, ACLLH_INITIAL);
+    render(full, w, 1, w->lines.n + 1, 0);
+}
+
+static void update(struct acllh_ctx *skip, struct acllh_ctx *full, struct watched *w) {
+    struct acllh_lines fresh = { NULL, 0, 0 };
+    const char *nl;
+    unsigned char *states;
+    size_t size, common, prefix = 0, suffix = 0, start, tail, scanned;
+    size_t first, lines, old_lines = w->lines.n, stop, cand, want, step = WATCH_LOOKAHEAD;
+    long delta;
+    char *text;
+
+    if(!w->text) {
+        load(skip, full, w);
+        return;
+    }
+    text = read_file(w->path, &size);
+    if(!text) return;
+
+    common = size < w->size ? size : w->size;
+    while(prefix < common && text[prefix] == w->text[prefix]) prefix++;
+    if(prefix == size && size == w->size) {
+        // saved without changes
+        free(text);
+        return;
+    }
+    while(suffix < common - prefix && text[size - 1 - suffix] == w->text[w->size - 1 - suffix]) {
+        suffix++;
+    }
+    tail = size - suffix;
+
+    // lines up to the one the change starts in kept their states
+    for(start = prefix; start && text[start - 1] != '\n'; --start);
+    first = 1 + count_lines(text, text + start);
+    lines = old_lines - count_lines(w->text + start, w->text + w->size - suffix)
+            + count_lines(text + start, text + tail);
+    delta = (long)lines - (long)old_lines;
+
+    // a line after the change whose newline before it is common to both
+    // versions has an old counterpart; the first that starts in its old
+    // state ends the hunk
+    lines_push(&fresh, w->lines.states[first - 1]);
+    scanned = start;
+    stop = lines + 1;
+    nl = tail < size ? memchr(text + tail, '\n', size - tail) : NULL;
+    cand = nl ? first + count_lines(text + start, nl + 1) : lines + 1;
+    want = cand;
+    while(scanned < size) {
+        size_t at = first + fresh.n - 1;
+        size_t to = line_offset(text, size, scanned, at, want);
+
+        scan_states(skip, &fresh, text, scanned, to - scanned, at, fresh.states[fresh.n - 1]);
+        scanned = to;
+        for(; cand < first + fresh.n; ++cand) {
+            if(fresh.states[cand - first] == w->lines.states[cand - delta - 1]) break;
+        }
+        if(cand < first + fresh.n) {
+            stop = cand;
+            break;
+        }
+        want += step;
+        step *= 2;
+    }
+
+    // old states before the hunk, new ones in it, old ones after it
+    states = watch_alloc(lines);
+    memcpy(states, w->lines.states, first - 1);
+    memcpy(states + first - 1, fresh.states, stop - first);
+    memcpy(states + stop - 1, w->lines.states + stop - delta - 1, lines + 1 - stop);
+    free(fresh.states);
+    free(w->lines.states);
+    w->lines.states = states;
+    w->lines.n = w->lines.cap = lines;
+
+    free(w->text);
+    w->text = text;
+    w->size = size;
+    render(full, w, first, stop, stop - delta - first);
+}
+
+static struct acllh_ctx *watch_ctx(const struct acllh_backend *backend, const struct out_style *style) {
+    struct acllh_ctx *ctx = watch_alloc(sizeof(struct acllh_ctx));
+
+    if(backend->ctx_init(ctx) < 0) {
+        perror("acllh");
+        exit(1);
+    }
+    out_init_mem(&ctx->text);
+    ctx->text.style = style;
+    out_init_mem(&ctx->log);
+    return ctx;
+}
+
+int acllh_watch(char **paths, int n, const struct out_style *style) {
+    struct watched *files = watch_alloc(n * sizeof(struct watched));
+    struct acllh_ctx *skip = watch_ctx(&acllh_stats_backend, style);
+    struct acllh_ctx *full = watch_ctx(&acllh_full_backend, style);
+    char *events = watch_alloc(WATCH_EVENTS_SIZE);
+    int i, fd = inotify_init1(IN_CLOEXEC);
+
+    if(fd < 0) {
+        perror("inotify_init1");
+        return -1;
+    }
+
+    for(i = 0; i < n; ++i) {
+        struct watched *w = &files[i];
+        char *slash;
+
+        if(decomp_kind(paths[i])) {
+            fprintf(stderr, "%s: --watch needs an uncompressed file\n", paths[i]);
+            return -1;
+        }
+        w->path = strdup(paths[i]);
+        slash = strrchr(w->path, '/');
+        w->name = slash ? slash + 1 : w->path;
+
+        // the directory, so that a file renamed over this one is noticed
+        if(slash) *slash = '\0';
+        w->wd = inotify_add_watch(fd, slash ? (slash == w->path ? "/" : w->path) : ".",
+                                  IN_CLOSE_WRITE | IN_MOVED_TO);
+        if(slash) *slash = '/';
+        if(w->wd < 0) {
+            perror(w->path);
+            return -1;
+        }
+        load(skip, full, w);
+    }
+
+    for(;;) {
+        ssize_t len = read(fd, events, WATCH_EVENTS_SIZE);
+        char *p;
+
+        if(len < 0 && errno == EINTR) continue;
+        if(len <= 0) {
+            perror("inotify");
+            return -1;
+        }
+        for(p = events; p < events + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            const struct inotify_event *e = (const struct inotify_event *)p;
+
+            if(!e->len) continue;
+            for(i = 0; i < n; ++i) {
+                if(files[i].wd == e->wd && !strcmp(files[i].name, e->name)) update(skip, full, &files[i]);
+            }
+        }
+    }
+}
@@ -0,0 +1,436 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "xref.h"
+
+struct bytes {
+    unsigned char *p;
+    size_t n;
+    size_t cap;
+};
+
+static void *xref_alloc(size_t size) {
+    void *m = calloc(1, size ? size : 1);
+    if(!m) {
+        perror("acllh");
+        exit(1);
+    }
+    return m;
+}
+
+static void *xref_grow(void *m, size_t *cap, size_t need, size_t size) {
+    if(need <= *cap) return m;
+    while(*cap < need) *cap = *cap ? *cap * 2 : 256;
+    m = realloc(m, *cap * size);
+    if(!m) {
+        perror("acllh");
+        exit(1);
+    }
+    return m;
+}
+
+static void bytes_put(struct bytes *b, const void *s, size_t n) {
+    b->p = xref_grow(b->p, &b->cap, b->n + n, 1);
+    memcpy(b->p + b->n, s, n);
+    b->n += n;
+}
+
+static void bytes_varint(struct bytes *b, uint32_t v) {
+    unsigned char buf[5];
+    int n = 0;
+
+    do {
+        buf[n++] = (v & 0x7f) | (v >= 0x80 ? 0x80 : 0);
+        v >>= 7;
+    } while(v);
+    bytes_put(b, buf, n);
+}
+
+struct xref_file *xref_file_create(void) {
+    struct xref_file *f = xref_alloc(sizeof(struct xref_file));
+
+    f->names = intern_create();
+    return f;
+}
+
+void xref_file_destroy(struct xref_file *f) {
+    if(!f) return;
+    intern_destroy(f->names);
+    free(f->occs);
+    free(f);
+}
+
+void xref_file_clear(struct xref_file *f) {
+    intern_clear(f->names);
+    f->n = 0;
+}
+
+void xref_add(struct xref_file *f, const char *name, size_t len, uint32_t line, uint32_t col) {
+    struct xref_occ *o;
+
+    if(f->n == f->cap) f->occs = xref_grow(f->occs, &f->cap, f->n + 1, sizeof(struct xref_occ));
+    o = &f->occs[f->n++];
+    o->name = intern_id(f->names, name, len);
+    o->line = line;
+    o->col = col;
+}
+
+/* the file's names by id, so id i is names[i] */
+static const struct intern_entry **names_by_id(const struct intern_table *t) {
+    const struct intern_entry **names = xref_alloc(t->used * sizeof(struct intern_entry *));
+    size_t i;
+
+    for(i = 0; i < t->cap; ++i) {
+        if(t->slots[i].name) names[t->slots[i].id] = &t->slots[i];
+    }
+    return names;
+}
+
+/* blob layout: uint64_t nnames, nocc; per name uint32_t len and the bytes; the occurrences */
+char *xref_file_pack(const struct xref_file *f, size_t *len) {
+    const struct intern_entry **names = names_by_id(f->names);
+    struct bytes b = { NULL, 0, 0 };
+    uint64_t nnames = f->names->used, nocc = f->n;
+    size_t i;
+
+    bytes_put(&b, &nnames, sizeof(nnames));
+    bytes_put(&b, &nocc, sizeof(nocc));
+    for(i = 0; i < nnames; ++i) {
+        uint32_t n = names[i]->len;
+
+        bytes_put(&b, &n, sizeof(n));
+        bytes_put(&b, names[i]->name, n);
+    }
+    bytes_put(&b, f->occs, nocc * sizeof(struct xref_occ));
+    free(names);
+
+    *len = b.n;
+    return (char *)b.p;
+}
+
+int xref_file_unpack(struct xref_file *f, const char *blob, size_t len) {
+    const char *p = blob, *end = blob + len;
+    uint64_t nnames, nocc, i;
+    uint32_t *map;
+
+    if(len < 2 * sizeof(uint64_t)) return -1;
+    memcpy(&nnames, p, sizeof(nnames));
+    memcpy(&nocc, p + sizeof(nnames), sizeof(nocc));
+    p += 2 * sizeof(uint64_t);
+    if(nnames > len || nocc > len) return -1;
+
+    map = xref_alloc(nnames * sizeof(uint32_t));
+    for(i = 0; i < nnames; ++i) {
+        uint32_t n;
+
+        if((size_t)(end - p) < sizeof(n)) break;
+        memcpy(&n, p, sizeof(n));
+        p += sizeof(n);
+        if((size_t)(end - p) < n) break;
+        map[i] = intern_id(f->names, p, n);
+        p += n;
+    }
+    if(i < nnames || (size_t)(end - p) != nocc * sizeof(struct xref_occ)) {
+        free(map);
+        return -1;
+    }
+
+    f->occs = xref_grow(f->occs, &f->cap, f->n + nocc, sizeof(struct xref_occ));
+    for(i = 0; i < nocc; ++i) {
+        struct xref_occ *o = &f->occs[f->n];
+
+        memcpy(o, p + i * sizeof(struct xref_occ), sizeof(struct xref_occ));
+        if(o->name >= nnames) {
+            free(map);
+            return -1;
+        }
+        o->name = map[o->name];
+        f->n++;
+    }
+    free(map);
+    return 0;
+}
+
+struct xref_builder *xref_builder_create(void) {
+    struct xref_builder *b = xref_alloc(sizeof(struct xref_builder));
+
+    b->names = intern_create();
+    return b;
+}
+
+void xref_builder_destroy(struct xref_builder *b) {
+    size_t i;
+
+    if(!b) return;
+    for(i = 0; i < b->nlists; ++i) free(b->lists[i].locs);
+    for(i = 0; i < b->nfiles; ++i) free(b->paths[i]);
+    free(b->lists);
+    free(b->paths);
+    intern_destroy(b->names);
+    free(b);
+}
+
+uint32_t xref_builder_file(struct xref_builder *b, const char *path) {
+    size_t cap = b->paths_cap;
+
+    b->paths = xref_grow(b->paths, &cap, b->nfiles + 1, sizeof(char *));
+    b->paths_cap = cap;
+    b->paths[b->nfiles] = strdup(path);
+    if(!b->paths[b->nfiles]) {
+        perror("acllh");
+        exit(1);
+    }
+    return b->nfiles++;
+}
+
+/* append a file's (or chunk's) occurrences; calls for one file come in order */
+void xref_builder_add(struct xref_builder *b, uint32_t file, const struct xref_file *f) {
+    const struct intern_entry **names = names_by_id(f->names);
+    size_t *global = xref_alloc(f->names->used * sizeof(size_t));
+    size_t i, cap = b->nlists;
+
+    for(i = 0; i < f->names->used; ++i) global[i] = intern_id(b->names, names[i]->name, names[i]->len);
+    if(b->names->used > b->nlists) {
+        b->lists = xref_grow(b->lists, &cap, b->names->used, sizeof(struct xref_list));
+        memset(b->lists + b->nlists, 0, (cap - b->nlists) * sizeof(struct xref_list));
+        b->nlists = cap;
+    }
+
+    for(i = 0; i < f->n; ++i) {
+        struct xref_list *l = &b->lists[global[f->occs[i].name]];
+        struct xref_loc *loc;
+
+        if(l->n == l->cap) l->locs = xref_grow(l->locs, &l->cap, l->n + 1, sizeof(struct xref_loc));
+        loc = &l->locs[l->n++];
+        loc->file = file;
+        loc->line = f->occs[i].line;
+        loc->col = f->occs[i].col;
+    }
+    free(global);
+    free(names);
+}
+
+static int cmp_name(const void *a, const void *b) {
+    const struct intern_entry *x = *(const struct intern_entry **)a;
+    const struct intern_entry *y = *(const struct intern_entry **)b;
+    int c = memcmp(x->name, y->name, x->len < y->len ? x->len : y->len);
+
+    return c ? c : (x->len > y->len) - (x->len < y->len);
+}
+
+static int write_full(int fd, const void *s, size_t n) {
+    const char *p = s;
+
+    while(n > 0) {
+        ssize_t w = write(fd, p, n);
+
+        if(w < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+#define ALIGN8(n)               (((n) + 7) & ~(size_t)7)
+
+int xref_builder_write(const struct xref_builder *b, const char *path) {
+    const struct intern_entry **sorted = names_by_id(b->names);
+    uint32_t nnames = b->names->used, i;
+    struct xref_header h;
+    struct xref_path *paths = xref_alloc(b->nfiles * sizeof(struct xref_path));
+    struct xref_name *names = xref_alloc(nnames * sizeof(struct xref_name));
+    struct bytes strings = { NULL, 0, 0 }, postings = { NULL, 0, 0 };
+    static const char zero[8];
+    int fd, ret;
+
+    qsort(sorted, nnames, sizeof(struct intern_entry *), cmp_name);
+
+    for(i = 0; i < b->nfiles; ++i) {
+        paths[i].offset = strings.n;
+        paths[i].len = strlen(b->paths[i]);
+        bytes_put(&strings, b->paths[i], paths[i].len + 1);
+    }
+
+    for(i = 0; i < nnames; ++i) {
+        const struct xref_list *l = &b->lists[sorted[i]->id];
+        uint32_t file = 0, line = 0;
+        size_t k;
+
+        names[i].offset = strings.n;
+        names[i].len = sorted[i]->len;
+        names[i].count = l->n;
+        names[i].postings = postings.n;
+        bytes_put(&strings, sorted[i]->name, sorted[i]->len);
+
+        for(k = 0; k < l->n; ++k) {
+            const struct xref_loc *loc = &l->locs[k];
+
+            bytes_varint(&postings, loc->file - file);
+            bytes_varint(&postings, loc->file == file ? loc->line - line : loc->line);
+            bytes_varint(&postings, loc->col);
+            file = loc->file;
+            line = loc->line;
+        }
+        names[i].postings_len = postings.n - names[i].postings;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, XREF_MAGIC, 4);
+    h.version = XREF_VERSION;
+    h.nfiles = b->nfiles;
+    h.nnames = nnames;
+    h.paths_offset = sizeof(h);
+    h.names_offset = h.paths_offset + b->nfiles * sizeof(struct xref_path);
+    h.strings_offset = h.names_offset + (uint64_t)nnames * sizeof(struct xref_name);
+    h.postings_offset = ALIGN8(h.strings_offset + strings.n);
+    h.size = h.postings_offset + postings.n;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ret = (fd < 0
+           || write_full(fd, &h, sizeof(h)) < 0
+           || write_full(fd, paths, b->nfiles * sizeof(struct xref_path)) < 0
+           || write_full(fd, names, nnames * sizeof(struct xref_name)) < 0
+           || write_full(fd, strings.p, strings.n) < 0
+           || write_full(fd, zero, h.postings_offset - h.strings_offset - strings.n) < 0
+           || write_full(fd, postings.p, postings.n) < 0) ? -1 : 0;
+    if(fd >= 0 && close(fd) < 0) ret = -1;
+
+    free(strings.p);
+    free(postings.p);
+    free(names);
+    free(paths);
+    free(sorted);
+    return ret;
+}
+
+/* every path and name within the strings and its postings within the postings, so lookups can trust them */
+static int tables_valid(const struct xref_index *x) {
+    const struct xref_header *h = x->header;
+    uint64_t nstrings = h->postings_offset - h->strings_offset;
+    uint64_t npostings = h->size - h->postings_offset;
+    uint32_t i;
+
+    for(i = 0; i < h->nfiles; ++i) {
+        const struct xref_path *p = &x->paths[i];
+
+        // a path is printed with %s, so its NUL has to be there too
+        if(p->offset >= nstrings || p->len >= nstrings - p->offset || x->strings[p->offset + p->len]) return 0;
+    }
+    for(i = 0; i < h->nnames; ++i) {
+        const struct xref_name *n = &x->names[i];
+
+        if(n->offset > nstrings || n->len > nstrings - n->offset
+           || n->postings > npostings || n->postings_len > npostings - n->postings) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int xref_open(struct xref_index *x, const char *path) {
+    struct stat st;
+    const struct xref_header *h;
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0) return -1;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct xref_header)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    x->size = st.st_size;
+    x->base = mmap(NULL, x->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(x->base == MAP_FAILED) return -1;
+
+    // the tables follow each other, aligned, up to the postings at the end of the file
+    h = x->header = (const struct xref_header *)x->base;
+    if(memcmp(h->magic, XREF_MAGIC, 4) || h->version != XREF_VERSION || h->size != x->size
+       || h->paths_offset < sizeof(struct xref_header) || h->paths_offset > h->size || h->paths_offset % 8
+       || h->names_offset != h->paths_offset + (uint64_t)h->nfiles * sizeof(struct xref_path)
+       || h->strings_offset != h->names_offset + (uint64_t)h->nnames * sizeof(struct xref_name)
+       || h->postings_offset < h->strings_offset || h->postings_offset > h->size) {
+        goto bad;
+    }
+    x->paths = (const struct xref_path *)(x->base + h->paths_offset);
+    x->names = (const struct xref_name *)(x->base + h->names_offset);
+    x->strings = x->base + h->strings_offset;
+    x->postings = (const unsigned char *)x->base + h->postings_offset;
+    if(!tables_valid(x)) goto bad;
+    return 0;
+
+bad:
+    munmap((void *)x->base, x->size);
+    errno = EINVAL;
+    return -1;
+}
+
+void xref_close(struct xref_index *x) {
+    munmap((void *)x->base, x->size);
+}
+
+const struct xref_name *xref_find(const struct xref_index *x, const char *name, size_t len) {
+    size_t lo = 0, hi = x->header->nnames;
+
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const struct xref_name *n = &x->names[mid];
+        int c = memcmp(x->strings + n->offset, name, n->len < len ? n->len : len);
+
+        if(!c) c = (n->len > len) - (n->len < len);
+        if(!c) return n;
+        if(c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+void xref_cursor_init(const struct xref_index *x, const struct xref_name *n, struct xref_cursor *c) {
+    c->p = x->postings + n->postings;
+    c->end = c->p + n->postings_len;
+    c->file = 0;
+    c->line = 0;
+}
+
+static int get_varint(struct xref_cursor *c, uint32_t *v) {
+    uint32_t r = 0;
+    int shift = 0;
+
+    while(c->p < c->end && shift < 35) {
+        unsigned char b = *c->p++;
+
+        r |= (uint32_t)(b & 0x7f) << shift;
+        if(!(b & 0x80)) {
+            *v = r;
+            return 0;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+/* the next location; 0 at the end of the list, -1 on a damaged one */
+int xref_next(struct xref_cursor *c, struct xref_loc *loc) {
+    uint32_t file, line, col;
+
+    if(c->p == c->end) return 0;
+    if(get_varint(c, &file) < 0 || get_varint(c, &line) < 0 || get_varint(c, &col) < 0) return -1;
+    if(file) {
+        c->file += file;
+        c->line = line;
+    } else {
+        c->line += line;
+    }
+    loc->file = c->file;
+    loc->line = c->line;
+    loc->col = col;
+    return 1;
+}
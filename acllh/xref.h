@@ -0,0 +1,134 @@
+#ifndef __ACLLH_XREF_H
+#define __ACLLH_XREF_H
+
+/*
+ *      Cross-reference index (identifier to locations)
+ *
+ *      Built while highlighting, written once at the end, read by mapping
+ *      the file:
+ *
+ *          struct xref_header
+ *          struct xref_path        [nfiles]
+ *          struct xref_name        [nnames], sorted by name
+ *          strings                 paths (NUL-terminated) and names
+ *          postings                one byte run per name
+ *
+ *      A name's postings are its (file, line, column) locations in
+ *      order, as LEB128 varints: the file delta, then the line (a delta
+ *      when the file did not change), then the column. Columns count
+ *      bytes from 1. A lookup is a binary search over the name table and
+ *      a walk over one run of bytes, with no parsing of anything else.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "intern.h"
+
+#define XREF_MAGIC              "ACLX"
+#define XREF_VERSION            1
+
+struct xref_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t nfiles;
+    uint32_t nnames;
+    uint64_t paths_offset;
+    uint64_t names_offset;
+    uint64_t strings_offset;
+    uint64_t postings_offset;
+    uint64_t size;
+};
+
+struct xref_path {
+    uint64_t offset;            // into strings
+    uint32_t len;
+    uint32_t reserved;
+};
+
+struct xref_name {
+    uint64_t offset;            // into strings
+    uint32_t len;
+    uint32_t count;             // locations
+    uint64_t postings;          // into postings
+    uint64_t postings_len;
+};
+
+/* one identifier occurrence, the name numbered within its file */
+struct xref_occ {
+    uint32_t name;
+    uint32_t line;
+    uint32_t col;
+};
+
+/* occurrences collected by one scanner for one file or chunk */
+struct xref_file {
+    struct intern_table *names;
+    struct xref_occ *occs;
+    size_t n;
+    size_t cap;
+};
+
+struct xref_file *xref_file_create(void);
+void xref_file_destroy(struct xref_file *f);
+void xref_file_clear(struct xref_file *f);
+void xref_add(struct xref_file *f, const char *name, size_t len, uint32_t line, uint32_t col);
+char *xref_file_pack(const struct xref_file *f, size_t *len);
+int xref_file_unpack(struct xref_file *f, const char *blob, size_t len);
+
+/* the whole index, fed file by file in output order */
+struct xref_loc {
+    uint32_t file;
+    uint32_t line;
+    uint32_t col;
+};
+
+struct xref_list {
+    struct xref_loc *locs;
+    size_t n;
+    size_t cap;
+};
+
+struct xref_builder {
+    struct intern_table *names;     // ids index lists
+    struct xref_list *lists;
+    size_t nlists;
+    char **paths;
+    uint32_t nfiles;
+    uint32_t paths_cap;
+};
+
+struct xref_builder *xref_builder_create(void);
+void xref_builder_destroy(struct xref_builder *b);
+uint32_t xref_builder_file(struct xref_builder *b, const char *path);
+void xref_builder_add(struct xref_builder *b, uint32_t file, const struct xref_file *f);
+int xref_builder_write(const struct xref_builder *b, const char *path);
+
+/* reader */
+struct xref_index {
+    const char *base;
+    size_t size;
+    const struct xref_header *header;
+    const struct xref_path *paths;
+    const struct xref_name *names;
+    const char *strings;
+    const unsigned char *postings;
+};
+
+struct xref_cursor {
+    const unsigned char *p;
+    const unsigned char *end;
+    uint32_t file;
+    uint32_t line;
+};
+
+int xref_open(struct xref_index *x, const char *path);
+void xref_close(struct xref_index *x);
+const struct xref_name *xref_find(const struct xref_index *x, const char *name, size_t len);
+void xref_cursor_init(const struct xref_index *x, const struct xref_name *n, struct xref_cursor *c);
+int xref_next(struct xref_cursor *c, struct xref_loc *loc);
+
+static inline const char *xref_path(const struct xref_index *x, uint32_t file) {
+    return x->strings + x->paths[file].offset;
+}
+
+#endif
@@ -1,16 +1,40 @@
 #ifndef __SENIOR_CALCULATOR_H
 #define __SENIOR_CALCULATOR_H
 
+#include <stddef.h>
+
+/* bump allocator: everything in it goes at once on arena_reset() */
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct arena {
+    struct arena_block *head;
+    struct arena_block *cur; // blocks after cur are kept for reuse
+};
+
+void *arena_alloc(struct arena *a, size_t size);
+void arena_reset(struct arena *a);
+
+/* the tree of the statement being parsed and evaluated */
+extern struct arena stmt_arena;
+
 struct symbol {
     char *name;
     double value;
     struct ast *func;
     struct symlist *syms;
+    struct arena body; // holds func, syms and code, copied out of stmt_arena by dodef
+    struct code *code; // func compiled, NULL when func is
+    int nparams;
+    struct symbol *next; // the one made before
 };
 
-#define NHASH 9997
-
-struct symbol symtab[NHASH];
+/* every symbol ever looked up, newest first; they never move or go away */
+extern struct symbol *symbols;
 
 struct symbol *lookup(char*);
 
@@ -21,8 +45,6 @@ struct symlist {
 
 struct symlist *newsymlist(struct symbol *sym, struct symlist *next);
 
-void symlistfree(struct symlist *sl);
-
 enum bifs {
     B_sqrt = 1,
     B_exp,
@@ -85,7 +107,51 @@ void dodef(struct symbol *name, struct symlist *syms, struct ast *stmts);
 
 double eval(struct ast *);
 
-void treefree(struct ast *);
+/* folds constants and drops identities, keeping eval()'s result bit for bit */
+struct ast *simplify(struct ast *a);
+void treeprint(struct ast *a, int islist);
+
+extern int showtree; // -p: print each statement as simplified
+
+/* bytecode: what eval() does for a tree, as one flat run of words */
+enum opcode {
+    OP_CONST,   // num: push it
+    OP_LOAD,    // sym: push its value
+    OP_STORE,   // sym: set it to the top, which stays
+    OP_POP,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV,
+    OP_ABS, OP_NEG,
+    OP_GT, OP_LT, OP_NE, OP_EQ, OP_GE, OP_LE, // '1'..'6'
+    OP_JMP,     // off: relative to the word after it
+    OP_JZ,      // off: pop, jump when 0
+    OP_SQRT, OP_EXP, OP_LOG, OP_PRINT,
+    OP_ARGS,    // sym off: push 0 and jump when sym has no body, else go on to its arguments
+    OP_ARGCHK,  // sym n off: jump to the OP_CALL when sym takes no more than n arguments
+    OP_CALL,    // sym n: call sym with the first n arguments, or as many as it takes
+    OP_NULL,    // eval(NULL): complain, push 0
+    OP_RET,     // return the top
+    OP_NUM
+};
+
+union word {
+    int op;
+    int off;
+    int n;
+    double num;
+    struct symbol *sym;
+};
+
+struct code {
+    int maxstack;
+    int len;
+    union word w[];
+};
+
+struct code *compile(struct arena *a, struct ast *t);
+double run(struct code *c);
+
+/* a top-level statement: compiled and run, or with -b walked and run both */
+double evalstmt(struct ast *a);
 
 extern int yylineno;
 
@@ -3,6 +3,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 #include "../inc/senior-calculator.h"
 
 static void* makesure_malloc(unsigned int m_size) {
@@ -14,38 +15,169 @@ static void* makesure_malloc(unsigned int m_size) {
     return m;
 }
 
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_ALIGN sizeof(double)
+
+struct arena stmt_arena;
+
+static struct arena_block *newblock(size_t size) {
+    struct arena_block *b;
+    
+    if(size < ARENA_BLOCK_SIZE) size = ARENA_BLOCK_SIZE;
+    b = makesure_malloc(sizeof(struct arena_block) + size);
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    
+    return b;
+}
+
+void *arena_alloc(struct arena *a, size_t size) {
+    struct arena_block *b = a->cur;
+    void *p;
+    
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if(!b) {
+        b = a->head = newblock(size);
+    } else if(b->size - b->used < size) {
+        // move on to the next kept block, or put a new one in front of it
+        if(!b->next || b->next->size < size) {
+            struct arena_block *nb = newblock(size);
+            
+            nb->next = b->next;
+            b->next = nb;
+        }
+        b = b->next;
+        b->used = 0;
+    }
+    a->cur = b;
+    
+    p = b->data + b->used;
+    b->used += size;
+    
+    return p;
+}
+
+void arena_reset(struct arena *a) {
+    a->cur = a->head;
+    if(a->head) a->head->used = 0;
+}
+
+/*
+ * Open addressing with linear probing. Each slot keeps the full hash, so
+ * strcmp() only runs on a real match. At 3/4 full the table doubles, but
+ * the entries move over a few slots per lookup: until the old table is
+ * empty, a name missing from the new one is looked for in the old one.
+ */
+#define SYMTAB_INITIAL 64 // slots, a power of two
+#define SYMTAB_REHASH_STEP 16 // old slots moved per lookup
+
+struct symslot {
+    unsigned int hash;
+    struct symbol *sym; // NULL when free
+};
+
+static struct {
+    struct symslot *slots;
+    unsigned int mask;
+    unsigned int count; // symbols, wherever they are
+    struct symslot *old; // NULL unless growing
+    unsigned int oldmask;
+    unsigned int moved; // old slots already moved
+} symtab;
+
+struct symbol *symbols;
+static struct arena symarena; // symbols and their names, never reset
+
 static unsigned symhash(char *sym) {
-    unsigned int hash = 0;
+    unsigned int hash = 2166136261u;
     unsigned c;
     
-    while(c = *sym++) hash = hash * 9 ^ c;
+    while(c = (unsigned char)*sym++) hash = (hash ^ c) * 16777619u;
     
     return hash;
 }
 
-struct symbol *lookup(char *sym) {
-    struct symbol *sp = &symtab[symhash(sym) % NHASH];
-    int scount = NHASH;
+static struct symslot *newslots(unsigned int n) {
+    struct symslot *s = calloc(n, sizeof(struct symslot));
+    
+    if(!s) {
+        yyerror("out of space");
+        exit(0);
+    }
+    return s;
+}
+
+static struct symbol *probe(struct symslot *slots, unsigned int mask, unsigned int hash, char *sym) {
+    unsigned int i;
+    
+    for(i = hash & mask; slots[i].sym; i = (i + 1) & mask) {
+        if(slots[i].hash == hash && !strcmp(slots[i].sym->name, sym)) return slots[i].sym;
+    }
+    return NULL;
+}
+
+static void put(unsigned int hash, struct symbol *sp) {
+    unsigned int i;
     
-    while(--scount >= 0) {
-        if(sp->name && !strcmp(sp->name, sym)) { return sp; }
+    for(i = hash & symtab.mask; symtab.slots[i].sym; i = (i + 1) & symtab.mask);
+    symtab.slots[i].hash = hash;
+    symtab.slots[i].sym = sp;
+}
+
+/* old entries are left in place: a lookup finding one there finds the same symbol */
+static void rehash(unsigned int n) {
+    for(; symtab.old && n; --n) {
+        struct symslot *o = &symtab.old[symtab.moved];
         
-        if(!sp->name) {
-            sp->name = strdup(sym);
-            sp->value = 0;
-            sp->func = NULL;
-            sp->syms = NULL;
-            return sp;
+        if(o->sym) put(o->hash, o->sym);
+        if(symtab.moved++ == symtab.oldmask) {
+            free(symtab.old);
+            symtab.old = NULL;
         }
-        
-        if(++sp >= symtab + NHASH) sp = symtab;
     }
-    yyerror("symbol table overflow\n");
-    abort();
+}
+
+static void grow(void) {
+    rehash(symtab.oldmask + 1); // only left over if lookups somehow outran the steps
+    symtab.old = symtab.slots;
+    symtab.oldmask = symtab.mask;
+    symtab.moved = 0;
+    symtab.mask = symtab.mask * 2 + 1;
+    symtab.slots = newslots(symtab.mask + 1);
+}
+
+struct symbol *lookup(char *sym) {
+    unsigned int hash = symhash(sym);
+    struct symbol *sp;
+    size_t len;
+    
+    if(!symtab.slots) {
+        symtab.slots = newslots(SYMTAB_INITIAL);
+        symtab.mask = SYMTAB_INITIAL - 1;
+    }
+    rehash(SYMTAB_REHASH_STEP);
+    
+    if((sp = probe(symtab.slots, symtab.mask, hash, sym))) return sp;
+    if(symtab.old && (sp = probe(symtab.old, symtab.oldmask, hash, sym))) return sp;
+    
+    if((symtab.count + 1) * 4 > (symtab.mask + 1) * 3) grow();
+    
+    sp = arena_alloc(&symarena, sizeof(struct symbol));
+    memset(sp, 0, sizeof(struct symbol));
+    len = strlen(sym) + 1;
+    sp->name = memcpy(arena_alloc(&symarena, len), sym, len);
+    sp->next = symbols;
+    symbols = sp;
+    
+    put(hash, sp);
+    symtab.count++;
+    
+    return sp;
 }
 
 struct ast *newast(int nodetype, struct ast *l, struct ast *r) {
-    struct ast *a = makesure_malloc(sizeof(struct ast));
+    struct ast *a = arena_alloc(&stmt_arena, sizeof(struct ast));
     
     a->nodetype = nodetype;
     a->l = l;
@@ -55,7 +187,7 @@ struct ast *newast(int nodetype, struct ast *l, struct ast *r) {
 }
 
 struct ast *newnum(double d) {
-    struct numval *a = makesure_malloc(sizeof(struct numval));
+    struct numval *a = arena_alloc(&stmt_arena, sizeof(struct numval));
     
     a->nodetype = 'K';
     a->number = d;
@@ -64,7 +196,7 @@ struct ast *newnum(double d) {
 }
 
 struct ast *newcmp(int cmptype, struct ast *l, struct ast *r) {
-    struct ast *a = makesure_malloc(sizeof(struct ast));
+    struct ast *a = arena_alloc(&stmt_arena, sizeof(struct ast));
     
     a->nodetype = '0' + cmptype;
     a->l = l;
@@ -74,7 +206,7 @@ struct ast *newcmp(int cmptype, struct ast *l, struct ast *r) {
 }
 
 struct ast *newfunc(int functype, struct ast *l) {
-    struct fncall *a = makesure_malloc(sizeof(struct fncall));
+    struct fncall *a = arena_alloc(&stmt_arena, sizeof(struct fncall));
     
     a->nodetype = 'F';
     a->l = l;
@@ -84,7 +216,7 @@ struct ast *newfunc(int functype, struct ast *l) {
 }
 
 struct ast *newcall(struct symbol *s, struct ast *l) {
-    struct ufncall *a = makesure_malloc(sizeof(struct ufncall));
+    struct ufncall *a = arena_alloc(&stmt_arena, sizeof(struct ufncall));
     
     a->nodetype = 'C';
     a->l = l;
@@ -94,7 +226,7 @@ struct ast *newcall(struct symbol *s, struct ast *l) {
 }
 
 struct ast *newref(struct symbol *s) {
-    struct symref *a = makesure_malloc(sizeof(struct symref));
+    struct symref *a = arena_alloc(&stmt_arena, sizeof(struct symref));
     
     a->nodetype = 'N';
     a->s = s;
@@ -103,7 +235,7 @@ struct ast *newref(struct symbol *s) {
 }
 
 struct ast *newasgn(struct symbol *s, struct ast *v) {
-    struct symasgn *a = makesure_malloc(sizeof(struct symasgn));
+    struct symasgn *a = arena_alloc(&stmt_arena, sizeof(struct symasgn));
     
     a->nodetype = '=';
     a->s = s;
@@ -114,7 +246,7 @@ struct ast *newasgn(struct symbol *s, struct ast *v) {
 
 struct ast *newflow(int nodetype, struct ast *cond,
                     struct ast *tl, struct ast *el) {
-    struct flow *a = makesure_malloc(sizeof(struct flow));
+    struct flow *a = arena_alloc(&stmt_arena, sizeof(struct flow));
     
     a->nodetype = nodetype;
     a->cond = cond;
@@ -124,36 +256,8 @@ struct ast *newflow(int nodetype, struct ast *cond,
     return (struct ast *)a;
 }
 
-void treefree(struct ast *a) {
-    switch(a->nodetype) {
-        case '+':
-        case '-':
-        case '*':
-        case '/':
-        case '1': case '2': case '3': case '4': case '5': case '6':
-        case 'L':
-            treefree(a->r);
-        case '|':
-        case 'M': case 'C': case 'F':
-            treefree(a->l);
-        case 'K': case 'N':
-            break;
-        case '=':
-            free( ((struct symasgn *)a)->v );
-            break;
-        case 'I': case 'W':
-            free( ((struct flow *)a)->cond );
-            if( ((struct flow *)a)->tl ) treefree( ((struct flow *)a)->tl );
-            if( ((struct flow *)a)->el ) treefree( ((struct flow *)a)->el );
-            break;
-        default: printf("Internal error: free bad node %c\n", a->nodetype);
-    }
-    
-    free(a);
-}
-
 struct symlist *newsymlist(struct symbol *sym, struct symlist *next) {
-    struct symlist *sl = makesure_malloc(sizeof(struct symlist));
+    struct symlist *sl = arena_alloc(&stmt_arena, sizeof(struct symlist));
     
     sl->sym = sym;
     sl->next = next;
@@ -161,22 +265,15 @@ struct symlist *newsymlist(struct symbol *sym, struct symlist *next) {
     return sl;
 }
 
-void symlistfree(struct symlist *sl) {
-    struct symlist *nsl;
-    
-    while(sl) {
-        nsl = sl->next;
-        free(sl);
-        sl = nsl;
-    }
-}
-
 static double callbuiltin(struct fncall *);
 static double calluser(struct ufncall *);
 
+static unsigned long long evalnodes; // eval() calls, the unit of work for -b
+
 double eval(struct ast *a) {
-    double v;
+    double v, l, r;
     
+    evalnodes++;
     if(!a) {
         yyerror("Internal error, null eval");
         return 0.0;
@@ -187,18 +284,19 @@ double eval(struct ast *a) {
         case 'N': v = ((struct symref *)a)->s->value; break;
         case '=': v = ((struct symasgn *)a)->s->value =
             eval( ((struct symasgn *)a)->v ); break;
-        case '+': v = eval(a->l) + eval(a->r); break;
-        case '-': v = eval(a->l) - eval(a->r); break;
-        case '*': v = eval(a->l) * eval(a->r); break;
-        case '/': v = eval(a->l) / eval(a->r); break;
+        // the left operand first, as the VM does; within one expression C leaves the order open
+        case '+': l = eval(a->l); r = eval(a->r); v = l + r; break;
+        case '-': l = eval(a->l); r = eval(a->r); v = l - r; break;
+        case '*': l = eval(a->l); r = eval(a->r); v = l * r; break;
+        case '/': l = eval(a->l); r = eval(a->r); v = l / r; break;
         case '|': v = fabs(eval(a->l)); break;
         case 'M': v = -eval(a->l); break;
-        case '1': v = (eval(a->l) > eval(a->r)) ? 1 : 0; break;
-        case '2': v = (eval(a->l) < eval(a->r)) ? 1 : 0; break;
-        case '3': v = (eval(a->l) != eval(a->r)) ? 1 : 0; break;
-        case '4': v = (eval(a->l) == eval(a->r)) ? 1 : 0; break;
-        case '5': v = (eval(a->l) >= eval(a->r)) ? 1 : 0; break;
-        case '6': v = (eval(a->l) <= eval(a->r)) ? 1 : 0; break;
+        case '1': l = eval(a->l); r = eval(a->r); v = (l > r) ? 1 : 0; break;
+        case '2': l = eval(a->l); r = eval(a->r); v = (l < r) ? 1 : 0; break;
+        case '3': l = eval(a->l); r = eval(a->r); v = (l != r) ? 1 : 0; break;
+        case '4': l = eval(a->l); r = eval(a->r); v = (l == r) ? 1 : 0; break;
+        case '5': l = eval(a->l); r = eval(a->r); v = (l >= r) ? 1 : 0; break;
+        case '6': l = eval(a->l); r = eval(a->r); v = (l <= r) ? 1 : 0; break;
         case 'I':
             if(eval( ((struct flow *)a)->cond )) {
                 if( ((struct flow *)a)->tl ) {
@@ -251,11 +349,87 @@ double callbuiltin(struct fncall *f) {
     }
 }
 
+/* a copy of t in a; 'L' lists are followed in a loop, however long they are */
+static struct ast *treecopy(struct arena *a, struct ast *t) {
+    struct ast *head = NULL;
+    struct ast **link = &head;
+    
+    for(; t; t = t->r) {
+        struct ast *c;
+        
+        switch(t->nodetype) {
+            case '+': case '-': case '*': case '/':
+            case '1': case '2': case '3': case '4': case '5': case '6':
+            case '|': case 'M':
+                c = arena_alloc(a, sizeof(struct ast));
+                *c = *t;
+                c->l = treecopy(a, t->l);
+                c->r = treecopy(a, t->r);
+                break;
+            case 'L':
+                c = arena_alloc(a, sizeof(struct ast));
+                c->nodetype = 'L';
+                c->l = treecopy(a, t->l);
+                c->r = NULL;
+                *link = c;
+                link = &c->r;
+                continue;
+            case 'K':
+                c = arena_alloc(a, sizeof(struct numval));
+                *(struct numval *)c = *(struct numval *)t;
+                break;
+            case 'N':
+                c = arena_alloc(a, sizeof(struct symref));
+                *(struct symref *)c = *(struct symref *)t;
+                break;
+            case '=':
+                c = arena_alloc(a, sizeof(struct symasgn));
+                *(struct symasgn *)c = *(struct symasgn *)t;
+                ((struct symasgn *)c)->v = treecopy(a, ((struct symasgn *)t)->v);
+                break;
+            case 'F':
+                c = arena_alloc(a, sizeof(struct fncall));
+                *(struct fncall *)c = *(struct fncall *)t;
+                c->l = treecopy(a, t->l);
+                break;
+            case 'C':
+                c = arena_alloc(a, sizeof(struct ufncall));
+                *(struct ufncall *)c = *(struct ufncall *)t;
+                c->l = treecopy(a, t->l);
+                break;
+            case 'I': case 'W':
+                c = arena_alloc(a, sizeof(struct flow));
+                *(struct flow *)c = *(struct flow *)t;
+                ((struct flow *)c)->cond = treecopy(a, ((struct flow *)t)->cond);
+                ((struct flow *)c)->tl = treecopy(a, ((struct flow *)t)->tl);
+                ((struct flow *)c)->el = treecopy(a, ((struct flow *)t)->el);
+                break;
+            default:
+                printf("Internal error: copy bad node %c\n", t->nodetype);
+                c = NULL;
+        }
+        *link = c;
+        break;
+    }
+    
+    return head;
+}
+
+/* the body outlives stmt_arena, so it moves into the symbol's own arena */
 void dodef(struct symbol *name, struct symlist *syms, struct ast *func) {
-    if(name->syms) symlistfree(name->syms);
-    if(name->func) treefree(name->func);
-    name->syms = syms;
-    name->func = func;
+    struct symlist **link = &name->syms;
+    
+    arena_reset(&name->body);
+    for(; syms; syms = syms->next) {
+        *link = arena_alloc(&name->body, sizeof(struct symlist));
+        (*link)->sym = syms->sym;
+        link = &(*link)->next;
+    }
+    *link = NULL;
+    name->nparams = 0;
+    for(syms = name->syms; syms; syms = syms->next) name->nparams++;
+    name->func = treecopy(&name->body, func);
+    name->code = name->func ? compile(&name->body, name->func) : NULL;
 }
 
 double calluser(struct ufncall *f) {
@@ -326,6 +500,603 @@ double calluser(struct ufncall *f) {
     return v;
 }
 
+int showtree;
+
+static int isnum(struct ast *a) {
+    return a && a->nodetype == 'K';
+}
+
+/* the constant a is, bit for bit, so 1 is not 1.0000001 and -0 is not +0 */
+static int isnumber(struct ast *a, double d) {
+    return isnum(a) && !memcmp(&((struct numval *)a)->number, &d, sizeof(double));
+}
+
+/* evaluating a only yields a value: no assignment, call, print, error or endless loop */
+static int pure(struct ast *a) {
+    if(!a) return 0;
+    
+    switch(a->nodetype) {
+        case 'K': case 'N':
+            return 1;
+        case '+': case '-': case '*': case '/':
+        case '1': case '2': case '3': case '4': case '5': case '6':
+        case 'L':
+            return pure(a->l) && pure(a->r);
+        case '|': case 'M':
+            return pure(a->l);
+        case 'F':
+            return ((struct fncall *)a)->functype != B_print && pure(a->l);
+        default:
+            return 0;
+    }
+}
+
+/* a with constant operands only, replaced by its value */
+static struct ast *fold(struct ast *a) {
+    return newnum(eval(a));
+}
+
+/*
+ * Only rewrites that give the same bits for every operand, NaN and -0
+ * included: x*1, x/1, x-0 and x+(-0) are x, but x+0 is +0 for x = -0
+ * and x*0 is NaN for x = NaN, so those stay.
+ */
+struct ast *simplify(struct ast *a) {
+    struct flow *fl = (struct flow *)a;
+    struct ast **args;
+    
+    if(!a) return NULL;
+    
+    switch(a->nodetype) {
+        case '+': case '-': case '*': case '/':
+        case '1': case '2': case '3': case '4': case '5': case '6':
+            a->l = simplify(a->l);
+            a->r = simplify(a->r);
+            if(isnum(a->l) && isnum(a->r)) return fold(a);
+            if(a->nodetype == '*' && isnumber(a->r, 1.0)) return a->l;
+            if(a->nodetype == '*' && isnumber(a->l, 1.0)) return a->r;
+            if(a->nodetype == '/' && isnumber(a->r, 1.0)) return a->l;
+            if(a->nodetype == '-' && isnumber(a->r, 0.0)) return a->l;
+            if(a->nodetype == '+' && isnumber(a->r, -0.0)) return a->l;
+            if(a->nodetype == '+' && isnumber(a->l, -0.0)) return a->r;
+            break;
+        case 'M':
+            a->l = simplify(a->l);
+            if(isnum(a->l)) return fold(a);
+            if(a->l->nodetype == 'M') return a->l->l;
+            break;
+        case '|':
+            a->l = simplify(a->l);
+            if(isnum(a->l)) return fold(a);
+            if(a->l->nodetype == 'M') a->l = a->l->l;
+            if(a->l->nodetype == '|') return a->l;
+            break;
+        case 'F':
+            a->l = simplify(a->l);
+            if(isnum(a->l) && ((struct fncall *)a)->functype != B_print) return fold(a);
+            break;
+        case 'L':
+            // a statement list; the argument lists of calls are taken apart below
+            a->l = simplify(a->l);
+            a->r = simplify(a->r);
+            if(a->l->nodetype == 'L') {
+                // an if folded to a branch of several: splice them in, the last one is last no more
+                struct ast *head = a->l, *tail = head;
+                
+                while(tail->r->nodetype == 'L') tail = tail->r;
+                a->l = tail->r;
+                tail->r = pure(a->l) ? a->r : a;
+                return head;
+            }
+            if(pure(a->l)) return a->r;
+            break;
+        case 'C':
+            // an argument list, not a statement list: each argument on its own
+            for(args = &a->l; *args && (*args)->nodetype == 'L'; args = &(*args)->r) {
+                (*args)->l = simplify((*args)->l);
+            }
+            *args = simplify(*args);
+            break;
+        case '=':
+            ((struct symasgn *)a)->v = simplify(((struct symasgn *)a)->v);
+            break;
+        case 'I':
+            fl->cond = simplify(fl->cond);
+            fl->tl = simplify(fl->tl);
+            fl->el = simplify(fl->el);
+            if(isnum(fl->cond)) {
+                a = ((struct numval *)fl->cond)->number ? fl->tl : fl->el;
+                return a ? a : newnum(0.0);
+            }
+            break;
+        case 'W':
+            fl->cond = simplify(fl->cond);
+            fl->tl = simplify(fl->tl);
+            if(!fl->tl || isnumber(fl->cond, 0.0) || isnumber(fl->cond, -0.0)) return newnum(0.0);
+            break;
+    }
+    
+    return a;
+}
+
+/* as few digits as read back to the same double */
+static void printnum(double d) {
+    static volatile double zero = 0.0; // divided at run time, as eval() divides
+    char buf[32];
+    
+    // inf and nan would read back as names: print the division that gives the same bits
+    if(isinf(d)) {
+        printf(d > 0 ? "(1/0)" : "(-1/0)");
+        return;
+    }
+    if(isnan(d)) {
+        printf(!signbit(d) == !signbit(zero / zero) ? "(0/0)" : "-(0/0)");
+        return;
+    }
+    snprintf(buf, sizeof(buf), "%.15g", d);
+    if(strtod(buf, NULL) != d) snprintf(buf, sizeof(buf), "%.17g", d);
+    printf("%s", buf);
+}
+
+static void printnode(struct ast *a);
+
+/* statements each followed by ';', as the grammar has them */
+static void printlist(struct ast *a) {
+    for(; a && a->nodetype == 'L'; a = a->r) {
+        printnode(a->l);
+        printf("; ");
+    }
+    if(a) {
+        printnode(a);
+        printf("; ");
+    }
+}
+
+static void printargs(struct ast *a) {
+    for(; a && a->nodetype == 'L'; a = a->r) {
+        printnode(a->l);
+        printf(", ");
+    }
+    printnode(a);
+}
+
+static void printnode(struct ast *a) {
+    static const char *cmps[] = { ">", "<", "<>", "==", ">=", "<=" };
+    static const char *bifs[] = { "", "sqrt", "exp", "log", "print" };
+    struct flow *fl = (struct flow *)a;
+    
+    if(!a) return;
+    
+    switch(a->nodetype) {
+        case 'K': printnum(((struct numval *)a)->number); break;
+        case 'N': printf("%s", ((struct symref *)a)->s->name); break;
+        case '=':
+            printf("(%s = ", ((struct symasgn *)a)->s->name);
+            printnode(((struct symasgn *)a)->v);
+            printf(")");
+            break;
+        case '+': case '-': case '*': case '/':
+        case '1': case '2': case '3': case '4': case '5': case '6':
+            printf("(");
+            printnode(a->l);
+            if(a->nodetype >= '1' && a->nodetype <= '6') printf(" %s ", cmps[a->nodetype - '1']);
+            else printf(" %c ", a->nodetype);
+            printnode(a->r);
+            printf(")");
+            break;
+        case '|': printf("|"); printnode(a->l); break;
+        case 'M': printf("-"); printnode(a->l); break;
+        case 'F':
+            printf("%s(", bifs[((struct fncall *)a)->functype]);
+            printargs(a->l);
+            printf(")");
+            break;
+        case 'C':
+            printf("%s(", ((struct ufncall *)a)->s->name);
+            printargs(a->l);
+            printf(")");
+            break;
+        case 'L': printlist(a); break;
+        case 'I':
+            printf("if ");
+            printnode(fl->cond);
+            printf(" then ");
+            printlist(fl->tl);
+            if(fl->el) {
+                printf("else ");
+                printlist(fl->el);
+            }
+            break;
+        case 'W':
+            printf("while ");
+            printnode(fl->cond);
+            printf(" do ");
+            printlist(fl->tl);
+            break;
+        default: printf("?%c", a->nodetype);
+    }
+}
+
+/* as the grammar reads it back: a let body is a list, a statement line is one statement */
+void treeprint(struct ast *a, int islist) {
+    if(islist) {
+        printlist(a);
+    } else if(a && a->nodetype == 'L') {
+        // only an if folded away makes a statement into several
+        printf("if 1 then ");
+        printlist(a);
+    } else {
+        printnode(a);
+    }
+    printf("\n");
+}
+
+/* compile() builds the code here, then copies it into its arena */
+static union word *cbuf;
+static int clen, ccap;
+static int cdepth, cmaxdepth; // values on the stack at clen, and at most
+
+static void cword(void) {
+    if(clen == ccap) {
+        ccap = ccap ? ccap * 2 : 256;
+        cbuf = realloc(cbuf, ccap * sizeof(union word));
+        if(!cbuf) {
+            yyerror("out of space");
+            exit(0);
+        }
+    }
+}
+
+/* effect: how many values the op leaves on the stack, less those it takes */
+static void emit(enum opcode op, int effect) {
+    cword();
+    cbuf[clen++].op = op;
+    cdepth += effect;
+    if(cdepth > cmaxdepth) cmaxdepth = cdepth;
+}
+
+static void emitnum(double d) { cword(); cbuf[clen++].num = d; }
+static void emitsym(struct symbol *s) { cword(); cbuf[clen++].sym = s; }
+static void emitn(int n) { cword(); cbuf[clen++].n = n; }
+
+/* a jump offset to fill in later; returns where it is */
+static int emitoff(void) {
+    cword();
+    cbuf[clen].off = 0;
+    return clen++;
+}
+
+/* make the offset at at jump to target */
+static void patch(int at, int target) {
+    cbuf[at].off = target - (at + 1);
+}
+
+static void gen(struct ast *a);
+
+static void genor0(struct ast *a) {
+    if(a) {
+        gen(a);
+    } else {
+        emit(OP_CONST, 1);
+        emitnum(0.0);
+    }
+}
+
+/*
+ * calluser() evaluates no more arguments than the function takes, and
+ * none when it has no body, so each argument after the first is guarded
+ * by an OP_ARGCHK: the function may be redefined after this is compiled.
+ */
+static void gencall(struct ufncall *f) {
+    struct ast *args = f->l;
+    int skip, chain = -1, at, n;
+    
+    emit(OP_ARGS, 0);
+    emitsym(f->s);
+    skip = emitoff();
+    for(n = 0; args; ++n) {
+        struct ast *arg = args;
+        
+        if(args->nodetype == 'L') {
+            arg = args->l;
+            args = args->r;
+        } else {
+            args = NULL;
+        }
+        if(n) {
+            // the offsets are chained through the words until the OP_CALL is known
+            emit(OP_ARGCHK, 0);
+            emitsym(f->s);
+            emitn(n);
+            at = emitoff();
+            cbuf[at].off = chain;
+            chain = at;
+        }
+        gen(arg);
+    }
+    
+    at = clen;
+    emit(OP_CALL, 1 - n);
+    emitsym(f->s);
+    emitn(n);
+    while(chain >= 0) {
+        int next = cbuf[chain].off;
+        
+        patch(chain, at);
+        chain = next;
+    }
+    patch(skip, clen);
+}
+
+static void gen(struct ast *a) {
+    struct flow *fl = (struct flow *)a;
+    int top, jz, jmp;
+    
+    if(!a) {
+        emit(OP_NULL, 1);
+        return;
+    }
+    
+    switch(a->nodetype) {
+        case 'K':
+            emit(OP_CONST, 1);
+            emitnum(((struct numval *)a)->number);
+            break;
+        case 'N':
+            emit(OP_LOAD, 1);
+            emitsym(((struct symref *)a)->s);
+            break;
+        case '=':
+            gen(((struct symasgn *)a)->v);
+            emit(OP_STORE, 0);
+            emitsym(((struct symasgn *)a)->s);
+            break;
+        case '+': gen(a->l); gen(a->r); emit(OP_ADD, -1); break;
+        case '-': gen(a->l); gen(a->r); emit(OP_SUB, -1); break;
+        case '*': gen(a->l); gen(a->r); emit(OP_MUL, -1); break;
+        case '/': gen(a->l); gen(a->r); emit(OP_DIV, -1); break;
+        case '|': gen(a->l); emit(OP_ABS, 0); break;
+        case 'M': gen(a->l); emit(OP_NEG, 0); break;
+        case '1': case '2': case '3': case '4': case '5': case '6':
+            gen(a->l);
+            gen(a->r);
+            emit(OP_GT + a->nodetype - '1', -1);
+            break;
+        case 'I':
+            gen(fl->cond);
+            emit(OP_JZ, -1);
+            jz = emitoff();
+            genor0(fl->tl);
+            emit(OP_JMP, -1); // the else branch pushes its own value
+            jmp = emitoff();
+            patch(jz, clen);
+            genor0(fl->el);
+            patch(jmp, clen);
+            break;
+        case 'W':
+            // without a body eval() does not even look at the condition
+            emit(OP_CONST, 1);
+            emitnum(0.0);
+            if(!fl->tl) break;
+            top = clen;
+            gen(fl->cond);
+            emit(OP_JZ, -1);
+            jz = emitoff();
+            emit(OP_POP, -1);
+            gen(fl->tl);
+            emit(OP_JMP, 0);
+            patch(emitoff(), top);
+            patch(jz, clen);
+            break;
+        case 'L':
+            gen(a->l);
+            emit(OP_POP, -1);
+            gen(a->r);
+            break;
+        case 'F':
+            gen(a->l);
+            emit(OP_SQRT + ((struct fncall *)a)->functype - B_sqrt, 0);
+            break;
+        case 'C':
+            gencall((struct ufncall *)a);
+            break;
+        default:
+            printf("Internal error: bad node %c\n", a->nodetype);
+            genor0(NULL);
+    }
+}
+
+struct code *compile(struct arena *a, struct ast *t) {
+    struct code *c;
+    
+    clen = cdepth = cmaxdepth = 0;
+    gen(t);
+    emit(OP_RET, 0);
+    
+    c = arena_alloc(a, sizeof(struct code) + clen * sizeof(union word));
+    c->maxstack = cmaxdepth;
+    c->len = clen;
+    memcpy(c->w, cbuf, clen * sizeof(union word));
+    
+    return c;
+}
+
+/* calluser() for the n arguments at args, with fn known to have a body */
+static double callcode(struct symbol *fn, double *args) {
+    double oldval[fn->nparams];
+    struct symlist *sl;
+    double v;
+    int i;
+    
+    for(sl = fn->syms, i = 0; sl; sl = sl->next, ++i) {
+        oldval[i] = sl->sym->value;
+        sl->sym->value = args[i];
+    }
+    
+    v = run(fn->code);
+    
+    // in list order, as calluser() does, which matters when a name is there twice
+    for(sl = fn->syms, i = 0; sl; sl = sl->next, ++i) {
+        sl->sym->value = oldval[i];
+    }
+    
+    return v;
+}
+
+/* threaded dispatch where the compiler has labels as values, a switch elsewhere */
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define VM_THREADED
+#define VM_OP(op) L_##op:
+#define VM_NEXT() goto *labels[(pc++)->op]
+#else
+#define VM_OP(op) case op:
+#define VM_NEXT() continue
+#endif
+
+double run(struct code *c) {
+    double stack[c->maxstack];
+    double *sp = stack; // first free slot
+    union word *pc = c->w;
+    struct symbol *fn;
+    int n;
+    
+#ifdef VM_THREADED
+    static const void *labels[OP_NUM] = {
+        [OP_CONST] = &&L_OP_CONST, [OP_LOAD] = &&L_OP_LOAD, [OP_STORE] = &&L_OP_STORE,
+        [OP_POP] = &&L_OP_POP,
+        [OP_ADD] = &&L_OP_ADD, [OP_SUB] = &&L_OP_SUB, [OP_MUL] = &&L_OP_MUL, [OP_DIV] = &&L_OP_DIV,
+        [OP_ABS] = &&L_OP_ABS, [OP_NEG] = &&L_OP_NEG,
+        [OP_GT] = &&L_OP_GT, [OP_LT] = &&L_OP_LT, [OP_NE] = &&L_OP_NE,
+        [OP_EQ] = &&L_OP_EQ, [OP_GE] = &&L_OP_GE, [OP_LE] = &&L_OP_LE,
+        [OP_JMP] = &&L_OP_JMP, [OP_JZ] = &&L_OP_JZ,
+        [OP_SQRT] = &&L_OP_SQRT, [OP_EXP] = &&L_OP_EXP, [OP_LOG] = &&L_OP_LOG, [OP_PRINT] = &&L_OP_PRINT,
+        [OP_ARGS] = &&L_OP_ARGS, [OP_ARGCHK] = &&L_OP_ARGCHK, [OP_CALL] = &&L_OP_CALL,
+        [OP_NULL] = &&L_OP_NULL, [OP_RET] = &&L_OP_RET,
+    };
+    
+    VM_NEXT();
+#else
+    for(;;) switch((pc++)->op) {
+#endif
+        VM_OP(OP_CONST) *sp++ = (pc++)->num; VM_NEXT();
+        VM_OP(OP_LOAD) *sp++ = (pc++)->sym->value; VM_NEXT();
+        VM_OP(OP_STORE) (pc++)->sym->value = sp[-1]; VM_NEXT();
+        VM_OP(OP_POP) sp--; VM_NEXT();
+        VM_OP(OP_ADD) sp--; sp[-1] = sp[-1] + sp[0]; VM_NEXT();
+        VM_OP(OP_SUB) sp--; sp[-1] = sp[-1] - sp[0]; VM_NEXT();
+        VM_OP(OP_MUL) sp--; sp[-1] = sp[-1] * sp[0]; VM_NEXT();
+        VM_OP(OP_DIV) sp--; sp[-1] = sp[-1] / sp[0]; VM_NEXT();
+        VM_OP(OP_ABS) sp[-1] = fabs(sp[-1]); VM_NEXT();
+        VM_OP(OP_NEG) sp[-1] = -sp[-1]; VM_NEXT();
+        VM_OP(OP_GT) sp--; sp[-1] = (sp[-1] > sp[0]) ? 1 : 0; VM_NEXT();
+        VM_OP(OP_LT) sp--; sp[-1] = (sp[-1] < sp[0]) ? 1 : 0; VM_NEXT();
+        VM_OP(OP_NE) sp--; sp[-1] = (sp[-1] != sp[0]) ? 1 : 0; VM_NEXT();
+        VM_OP(OP_EQ) sp--; sp[-1] = (sp[-1] == sp[0]) ? 1 : 0; VM_NEXT();
+        VM_OP(OP_GE) sp--; sp[-1] = (sp[-1] >= sp[0]) ? 1 : 0; VM_NEXT();
+        VM_OP(OP_LE) sp--; sp[-1] = (sp[-1] <= sp[0]) ? 1 : 0; VM_NEXT();
+        VM_OP(OP_JMP) pc += pc->off + 1; VM_NEXT();
+        VM_OP(OP_JZ) pc += *--sp ? 1 : pc->off + 1; VM_NEXT();
+        VM_OP(OP_SQRT) sp[-1] = sqrt(sp[-1]); VM_NEXT();
+        VM_OP(OP_EXP) sp[-1] = exp(sp[-1]); VM_NEXT();
+        VM_OP(OP_LOG) sp[-1] = log(sp[-1]); VM_NEXT();
+        VM_OP(OP_PRINT) printf("= %4.4g\n", sp[-1]); VM_NEXT();
+        VM_OP(OP_ARGS)
+            fn = pc[0].sym;
+            if(fn->code) {
+                pc += 2;
+            } else {
+                yyerror("call to undefined function", fn->name);
+                *sp++ = 0;
+                pc += pc[1].off + 2;
+            }
+            VM_NEXT();
+        VM_OP(OP_ARGCHK) pc += pc[0].sym->nparams <= pc[1].n ? pc[2].off + 3 : 3; VM_NEXT();
+        VM_OP(OP_CALL)
+            fn = pc[0].sym;
+            n = pc[1].n < fn->nparams ? pc[1].n : fn->nparams;
+            pc += 2;
+            sp -= n;
+            if(n < fn->nparams) {
+                yyerror("too few args in call to %s", fn->name);
+                *sp++ = 0;
+            } else {
+                *sp = callcode(fn, sp);
+                sp++;
+            }
+            VM_NEXT();
+        VM_OP(OP_NULL)
+            yyerror("Internal error, null eval");
+            *sp++ = 0;
+            VM_NEXT();
+        VM_OP(OP_RET) return sp[-1];
+#ifndef VM_THREADED
+    }
+#endif
+}
+
+/* -b: every statement is walked and run, from the same symbol values */
+static int bench;
+static double bench_tree, bench_compile, bench_vm; // ns
+static int bench_mismatches;
+static double *before, *walked; // a value per symbol
+static unsigned int nsaved;
+
+static double now(void) {
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+double evalstmt(struct ast *a) {
+    struct symbol *sp;
+    struct code *c;
+    double t, v, tv;
+    int i;
+    
+    if(!bench) return run(compile(&stmt_arena, a));
+    
+    if(nsaved < symtab.count) {
+        nsaved = symtab.count;
+        before = realloc(before, nsaved * sizeof(double));
+        walked = realloc(walked, nsaved * sizeof(double));
+        if(!before || !walked) {
+            yyerror("out of space");
+            exit(0);
+        }
+    }
+    
+    for(sp = symbols, i = 0; sp; sp = sp->next, ++i) before[i] = sp->value;
+    t = now();
+    tv = eval(a);
+    bench_tree += now() - t;
+    for(sp = symbols, i = 0; sp; sp = sp->next, ++i) {
+        walked[i] = sp->value;
+        sp->value = before[i];
+    }
+    
+    t = now();
+    c = compile(&stmt_arena, a);
+    bench_compile += now() - t;
+    t = now();
+    v = run(c);
+    bench_vm += now() - t;
+    
+    if(memcmp(&v, &tv, sizeof(double))) {
+        yyerror("vm gives %g where the tree walker gives %g", v, tv);
+        bench_mismatches++;
+    }
+    for(sp = symbols, i = 0; sp; sp = sp->next, ++i) {
+        if(memcmp(&sp->value, &walked[i], sizeof(double))) {
+            yyerror("vm leaves %s = %g where the tree walker leaves %g",
+                    sp->name, sp->value, walked[i]);
+            bench_mismatches++;
+        }
+    }
+    
+    return v;
+}
+
 void yyerror(char *s, ...) {
     va_list ap;
     va_start(ap, s);
@@ -336,6 +1107,26 @@ void yyerror(char *s, ...) {
 }
 
 int main(int argc, char **argv) {
+    int r, i;
+    
+    for(i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "-b")) bench = 1;
+        else if(!strcmp(argv[i], "-p")) showtree = 1;
+    }
     printf("> ");
-    return yyparse();
+    r = yyparse();
+    
+    if(bench) {
+        fprintf(stderr, "%llu nodes evaluated\n", evalnodes);
+        fprintf(stderr, "tree walker  %10.3f ms %8.2f ns/node\n",
+                bench_tree / 1e6, bench_tree / evalnodes);
+        fprintf(stderr, "bytecode vm  %10.3f ms %8.2f ns/node (+ %.3f ms compiling)\n",
+                bench_vm / 1e6, bench_vm / evalnodes, bench_compile / 1e6);
+        if(bench_mismatches) {
+            fprintf(stderr, "%d mismatches\n", bench_mismatches);
+            r = 1;
+        }
+    }
+    
+    return r;
 }
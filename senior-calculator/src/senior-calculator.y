@@ -72,14 +72,21 @@ symlist: NAME { $$ = newsymlist($1, NULL); }
 
 calclist:
 | calclist stmt EOL {
-    printf("= %4.4g\n> ", eval($2));
-    treefree($2);
+    struct ast *a = simplify($2);
+    
+    if(showtree) treeprint(a, 0);
+    printf("= %4.4g\n> ", evalstmt(a));
+    arena_reset(&stmt_arena);
 }
 | calclist LET NAME '(' symlist ')' '=' list EOL {
-    dodef($3, $5, $8);
+    struct ast *a = simplify($8);
+    
+    if(showtree) treeprint(a, 1);
+    dodef($3, $5, a);
+    arena_reset(&stmt_arena);
     printf("Defined %s\n> ", $3->name);
 }
-| calclist error EOL { yyerrok; printf("> "); }
+| calclist error EOL { yyerrok; arena_reset(&stmt_arena); printf("> "); }
 ;
 
 %%